@@ -0,0 +1,110 @@
+/**
+ * @file arena.c
+ */
+
+#include "arena.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdalign.h>
+
+#define ARENA_ALIGN alignof(max_align_t)
+#define ARENA_MAX_GROWTH 4 // Most a reset keeps, as a multiple of the first chunk
+
+struct arena_t line_arena;
+
+/**
+ * Set up an empty arena. No memory is allocated until it's first used.
+ * @param arena Arena to initialize
+ * @param chunk_size Size of the first chunk
+ */
+void arena_init(struct arena_t* arena, size_t chunk_size) {
+	arena->chunks = NULL;
+	arena->chunk_size = chunk_size;
+	arena->base_size = chunk_size;
+	arena->used = 0;
+	arena->high_water = 0;
+	arena->capacity = 0;
+	arena->heap_allocs = 0;
+}
+
+/**
+ * Allocate memory from the arena. It lives until the next arena_reset()
+ * @param arena Arena to allocate from
+ * @param size Number of bytes needed
+ * @return Suitably aligned memory
+ */
+void* arena_alloc(struct arena_t* arena, size_t size) {
+	size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+	struct arena_chunk_t* chunk = arena->chunks;
+	if (chunk == NULL || chunk->size - chunk->used < size) {
+		size_t chunk_size = arena->chunk_size > size ? arena->chunk_size : size;
+		chunk = (struct arena_chunk_t*)malloc(sizeof(struct arena_chunk_t) + chunk_size);
+		chunk->next = arena->chunks;
+		chunk->size = chunk_size;
+		chunk->used = 0;
+		arena->chunks = chunk;
+		arena->capacity += chunk_size;
+		arena->heap_allocs++;
+	}
+
+	void* ptr = chunk->data + chunk->used;
+	chunk->used += size;
+	arena->used += size;
+	if (arena->used > arena->high_water) {
+		arena->high_water = arena->used;
+	}
+	return ptr;
+}
+
+/**
+ * Release everything allocated from the arena, keeping the memory around
+ * for next time, up to ARENA_MAX_GROWTH times its first chunk
+ * @param arena Arena to reset
+ */
+void arena_reset(struct arena_t* arena) {
+	size_t max_size = arena->base_size * ARENA_MAX_GROWTH;
+	if (arena->chunks && (arena->chunks->next || arena->chunks->size > max_size)) {
+		// We overflowed the chunk, so replace them all with a single chunk
+		// big enough that the next time won't need to allocate, unless it
+		// was a one-off spike we shouldn't hang on to
+		size_t capacity = arena->capacity;
+		arena_free(arena);
+		arena->chunk_size = capacity < max_size ? capacity : max_size;
+	} else if (arena->chunks) {
+		arena->chunks->used = 0;
+	}
+	arena->used = 0;
+}
+
+/**
+ * Give all of the arena's memory back
+ * @param arena Arena to free
+ */
+void arena_free(struct arena_t* arena) {
+	struct arena_chunk_t* chunk = arena->chunks;
+	while (chunk) {
+		struct arena_chunk_t* next = chunk->next;
+		free(chunk);
+		chunk = next;
+	}
+	arena->chunks = NULL;
+	arena->capacity = 0;
+	arena->used = 0;
+}
+
+/**
+ * Print how much an arena has needed, after the stats table
+ * @param arena Arena to describe
+ * @param name What to call it
+ * @param json As a JSON object instead
+ */
+void arena_print(const struct arena_t* arena, const char* name, int json) {
+	if (json) {
+		printf("{\"stat\": \"%s\", \"high_water\": %zu, \"capacity\": %zu, \"heap_allocs\": %zu}\n",
+			name, arena->high_water, arena->capacity, arena->heap_allocs);
+	} else {
+		printf("%s: %zu bytes at most, %zu bytes held, %zu heap allocations\n",
+			name, arena->high_water, arena->capacity, arena->heap_allocs);
+	}
+}
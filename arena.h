@@ -0,0 +1,37 @@
+/**
+ * @file arena.h
+ */
+
+#ifndef _ARENA_H
+#define _ARENA_H
+
+#include <stddef.h>
+
+struct arena_chunk_t {
+	struct arena_chunk_t* next;
+	size_t size;
+	size_t used;
+	char data[];
+};
+
+// Bump allocator for things that all die at the same time, like everything
+// parsed from one line of input
+struct arena_t {
+	struct arena_chunk_t* chunks; // Newest first
+	size_t chunk_size;  // Size of the next chunk we have to allocate
+	size_t base_size;   // Size of the first chunk, what it shrinks back towards
+	size_t used;        // Bytes handed out since the last reset
+	size_t high_water;  // Most bytes ever handed out between resets
+	size_t capacity;    // Bytes held in chunks
+	size_t heap_allocs; // Number of chunks ever malloc'd
+};
+
+extern struct arena_t line_arena; // Holds everything parsed from the current line
+
+void arena_init(struct arena_t* arena, size_t chunk_size);
+void* arena_alloc(struct arena_t* arena, size_t size);
+void arena_reset(struct arena_t* arena);
+void arena_free(struct arena_t* arena);
+void arena_print(const struct arena_t* arena, const char* name, int json);
+
+#endif // _ARENA_H
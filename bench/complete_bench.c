@@ -0,0 +1,111 @@
+/**
+ * @file complete_bench.c
+ *
+ * Times command name completion against a $PATH directory holding a lot of
+ * executables, through the trie as Tab does and by reading the directory
+ * for every completion for comparison.
+ *
+ * Usage: complete_bench [executables] [iterations]
+ * Prints one JSON object per line.
+ */
+
+#include "../complete.h"
+#include "../vars.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+static double now_us() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static size_t count_matches(char** matches) {
+	if (matches == NULL) {
+		return 0;
+	}
+	// A lone match comes without the common prefix in front of it
+	size_t count = matches[1] ? 0 : 1;
+	for (size_t i = 1; matches[i]; i++) {
+		count++;
+	}
+	for (char** match = matches; *match; match++) {
+		free(*match);
+	}
+	free(matches);
+	return count;
+}
+
+static size_t scan(const char* dir, const char* prefix) {
+	size_t len = strlen(prefix), count = 0;
+	DIR* d = opendir(dir);
+	struct dirent* entry;
+	while ((entry = readdir(d)) != NULL) {
+		if (strncmp(entry->d_name, prefix, len) == 0 && entry->d_name[0] != '.') {
+			count++;
+		}
+	}
+	closedir(d);
+	return count;
+}
+
+static void run(const char* dir, const char* name, const char* prefix, int iterations) {
+	size_t matches = 0;
+	double start = now_us();
+	for (int i = 0; i < iterations; i++) {
+		matches = count_matches(complete_command(prefix));
+	}
+	double trie_us = (now_us() - start) / iterations;
+
+	size_t scanned = 0;
+	start = now_us();
+	for (int i = 0; i < iterations; i++) {
+		scanned = scan(dir, prefix);
+	}
+	double scan_us = (now_us() - start) / iterations;
+
+	// The trie has the builtins too, the directory doesn't
+	printf("{\"bench\": \"complete\", \"case\": \"%s\", \"matches\": %zu, \"dir_matches\": %zu, "
+		"\"iterations\": %d, \"trie_us\": %.2f, \"readdir_us\": %.2f}\n",
+		name, matches, scanned, iterations, trie_us, scan_us);
+	fflush(stdout);
+}
+
+int main(int argc, char** argv) {
+	int executables = argc > 1 ? atoi(argv[1]) : 30000;
+	int iterations = argc > 2 ? atoi(argv[2]) : 100;
+
+	char dir[] = "/tmp/complete_benchXXXXXX";
+	if (mkdtemp(dir) == NULL) {
+		perror("complete_bench: mkdtemp");
+		return 1;
+	}
+	char path[256];
+	for (int i = 0; i < executables; i++) {
+		sprintf(path, "%s/cmd%05d", dir, i);
+		close(open(path, O_WRONLY | O_CREAT, 0755));
+	}
+	var_set("PATH", dir, 1);
+
+	double start = now_us();
+	count_matches(complete_command("cmd"));
+	printf("{\"bench\": \"complete\", \"case\": \"build\", \"executables\": %d, \"build_ms\": %.2f}\n",
+		executables, (now_us() - start) / 1e3);
+
+	run(dir, "unique", "cmd12345", iterations);
+	run(dir, "hundred", "cmd123", iterations);
+	run(dir, "no_match", "zz", iterations);
+	run(dir, "everything", "cmd", iterations / 10 + 1);
+
+	for (int i = 0; i < executables; i++) {
+		sprintf(path, "%s/cmd%05d", dir, i);
+		unlink(path);
+	}
+	rmdir(dir);
+	return 0;
+}
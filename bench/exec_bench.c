@@ -0,0 +1,145 @@
+/**
+ * @file exec_bench.c
+ *
+ * Measures what running commands through the shell costs end to end. The
+ * shell is started in script mode with its stdin and stdout connected to
+ * pipes, then each command is written to it one at a time and timed until
+ * its single line of output comes back.
+ *
+ * Usage: exec_bench [shell] [iterations] [longest pipeline]
+ * Prints one JSON object per line.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <spawn.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+extern char** environ;
+
+static int to_shell, from_shell;
+static char reply[4096];
+static size_t reply_len = 0;
+
+static double now_us() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static pid_t start_shell(const char* shell) {
+	int in[2], out[2];
+	if (pipe(in) < 0 || pipe(out) < 0) {
+		perror("exec_bench: pipe");
+		exit(1);
+	}
+
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_adddup2(&actions, in[0], STDIN_FILENO);
+	posix_spawn_file_actions_adddup2(&actions, out[1], STDOUT_FILENO);
+	posix_spawn_file_actions_addclose(&actions, in[0]);
+	posix_spawn_file_actions_addclose(&actions, in[1]);
+	posix_spawn_file_actions_addclose(&actions, out[0]);
+	posix_spawn_file_actions_addclose(&actions, out[1]);
+
+	char* argv[] = {(char*)shell, NULL};
+	pid_t pid;
+	int err = posix_spawn(&pid, shell, &actions, NULL, argv, environ);
+	posix_spawn_file_actions_destroy(&actions);
+	if (err != 0) {
+		fprintf(stderr, "exec_bench: can't run %s: %s\n", shell, strerror(err));
+		exit(1);
+	}
+
+	close(in[0]);
+	close(out[1]);
+	to_shell = in[1];
+	from_shell = out[0];
+	return pid;
+}
+
+/**
+ * Send a command and wait for the line it prints
+ */
+static void run_command(const char* line, size_t len) {
+	if (write(to_shell, line, len) != len) {
+		perror("exec_bench: write");
+		exit(1);
+	}
+	while (1) {
+		char* newline = memchr(reply, '\n', reply_len);
+		if (newline) {
+			size_t used = newline + 1 - reply;
+			memmove(reply, newline + 1, reply_len - used);
+			reply_len -= used;
+			return;
+		}
+		ssize_t n = read(from_shell, reply + reply_len, sizeof(reply) - reply_len);
+		if (n <= 0) {
+			fprintf(stderr, "exec_bench: shell went away running %s", line);
+			exit(1);
+		}
+		reply_len += n;
+	}
+}
+
+static int compare_double(const void* a, const void* b) {
+	double x = *(const double*)a, y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+static void run(const char* name, int stages, const char* line, int iterations) {
+	size_t len = strlen(line);
+	double* samples = (double*)malloc(sizeof(double) * iterations);
+
+	// Warm up, e.g. so the command hash is filled in
+	for (int i = 0; i < 10; i++) {
+		run_command(line, len);
+	}
+
+	double total = 0;
+	for (int i = 0; i < iterations; i++) {
+		double start = now_us();
+		run_command(line, len);
+		samples[i] = now_us() - start;
+		total += samples[i];
+	}
+	qsort(samples, iterations, sizeof(double), compare_double);
+
+	printf("{\"bench\": \"exec\", \"case\": \"%s\", \"stages\": %d, \"iterations\": %d, "
+		"\"mean_us\": %.1f, \"p50_us\": %.1f, \"p99_us\": %.1f, \"commands_per_s\": %.0f}\n",
+		name, stages, iterations, total / iterations,
+		samples[iterations / 2], samples[iterations * 99 / 100], iterations / (total / 1e6));
+	fflush(stdout);
+	free(samples);
+}
+
+int main(int argc, char** argv) {
+	const char* shell = argc > 1 ? argv[1] : "./shell";
+	int iterations = argc > 2 ? atoi(argv[2]) : 1000;
+	int max_stages = argc > 3 ? atoi(argv[3]) : 8;
+
+	pid_t pid = start_shell(shell);
+
+	run("builtin", 1, "pwd\n", iterations);
+
+	char line[4096];
+	for (int stages = 1; stages <= max_stages; stages++) {
+		char* w = stpcpy(line, "echo x");
+		for (int i = 1; i < stages; i++) {
+			w = stpcpy(w, " | cat");
+		}
+		strcpy(w, "\n");
+		// A one stage pipeline is just a single external
+		run(stages == 1 ? "external" : "pipeline", stages, line, iterations / stages > 50 ? iterations / stages : 50);
+	}
+
+	close(to_shell);
+	waitpid(pid, NULL, 0);
+	return 0;
+}
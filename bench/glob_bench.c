@@ -0,0 +1,117 @@
+/**
+ * @file glob_bench.c
+ *
+ * Measures pathname expansion in a directory with a lot of entries, through
+ * parse() as the shell does it and through glob(3) for comparison. Each
+ * line is parsed from scratch, so every iteration reads the directory again,
+ * but a line with several patterns over it only reads it once.
+ *
+ * Usage: glob_bench [entries] [iterations]
+ * Prints one JSON object per line.
+ */
+
+#include "../parser.h"
+#include "../arena.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <glob.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+struct bench_case_t {
+	const char* name;
+	const char* patterns[4]; // All on one line, NULL terminated
+};
+
+static const char* extensions[] = {"c", "h", "txt", "o"};
+
+static double now_ms() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void run(const char* dir, const struct bench_case_t* bench, int iterations) {
+	struct arena_t arena;
+	arena_init(&arena, 1 << 16);
+	char line[4096];
+	char buf[4096];
+	char* w = stpcpy(line, "ls");
+	for (int i = 0; i < 3 && bench->patterns[i]; i++) {
+		w += sprintf(w, " %s/%s", dir, bench->patterns[i]);
+	}
+
+	size_t matches = 0;
+	double start = now_ms();
+	for (int i = 0; i < iterations; i++) {
+		strcpy(buf, line);
+		struct command_t* cmd = new_command(&arena);
+		if (parse(cmd, buf) != kParseOK) {
+			fprintf(stderr, "glob_bench: %s failed to parse\n", bench->name);
+			exit(1);
+		}
+		matches = cmd->argc - 1;
+		arena_reset(&arena);
+	}
+	double parse_ms = (now_ms() - start) / iterations;
+
+	size_t glob_matches = 0;
+	start = now_ms();
+	for (int i = 0; i < iterations; i++) {
+		glob_t g;
+		for (int j = 0; j < 3 && bench->patterns[j]; j++) {
+			char pattern[4096];
+			sprintf(pattern, "%s/%s", dir, bench->patterns[j]);
+			glob(pattern, GLOB_NOCHECK | (j ? GLOB_APPEND : 0), NULL, &g);
+		}
+		glob_matches = g.gl_pathc;
+		globfree(&g);
+	}
+	double glob_ms = (now_ms() - start) / iterations;
+
+	if (matches != glob_matches) {
+		fprintf(stderr, "glob_bench: %s matched %zu, glob(3) matched %zu\n", bench->name, matches, glob_matches);
+	}
+	printf("{\"bench\": \"glob\", \"case\": \"%s\", \"matches\": %zu, \"iterations\": %d, "
+		"\"parse_ms\": %.3f, \"glob3_ms\": %.3f}\n",
+		bench->name, matches, iterations, parse_ms, glob_ms);
+	fflush(stdout);
+	arena_free(&arena);
+}
+
+int main(int argc, char** argv) {
+	int entries = argc > 1 ? atoi(argv[1]) : 100000;
+	int iterations = argc > 2 ? atoi(argv[2]) : 10;
+
+	char dir[] = "/tmp/glob_benchXXXXXX";
+	if (mkdtemp(dir) == NULL) {
+		perror("glob_bench: mkdtemp");
+		return 1;
+	}
+	char path[256];
+	for (int i = 0; i < entries; i++) {
+		sprintf(path, "%s/file%06d.%s", dir, i, extensions[i % 4]);
+		close(open(path, O_WRONLY | O_CREAT, 0600));
+	}
+
+	struct bench_case_t cases[] = {
+		{"suffix", {"*.c", NULL}},
+		{"prefix", {"file0123*", NULL}},
+		{"class", {"file[0-4]*7.[ch]", NULL}},
+		{"no_match", {"*.none", NULL}},
+		// One directory read for the line, three for glob(3)
+		{"three_patterns", {"*.c", "*.h", "file09*", NULL}},
+	};
+	for (int i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		run(dir, &cases[i], iterations);
+	}
+
+	for (int i = 0; i < entries; i++) {
+		sprintf(path, "%s/file%06d.%s", dir, i, extensions[i % 4]);
+		unlink(path);
+	}
+	rmdir(dir);
+	return 0;
+}
@@ -0,0 +1,102 @@
+/**
+ * @file history_bench.c
+ *
+ * Loads a large history file and times searching it, through the trigram
+ * index as Ctrl-R does and by scanning every entry for comparison.
+ *
+ * Usage: history_bench [entries] [iterations]
+ * Prints one JSON object per line.
+ */
+
+#define _GNU_SOURCE // memmem
+#include "../histdb.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char* templates[] = {
+	"git commit -m 'change %d'",
+	"make -j%d",
+	"cd /src/project%d",
+	"grep -rn pattern%d .",
+	"ssh host%d.example.com",
+};
+
+static double now_us() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static long scan(const char* query) {
+	size_t query_len = strlen(query);
+	for (long i = histdb_newest(); i >= 0; i = histdb_previous(i)) {
+		size_t len;
+		const char* line = histdb_line(i, &len);
+		if (memmem(line, len, query, query_len)) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+static void run(const char* name, const char* query, int iterations) {
+	long found = -1;
+	double start = now_us();
+	for (int i = 0; i < iterations; i++) {
+		found = histdb_search(query, -1);
+	}
+	double search_us = (now_us() - start) / iterations;
+
+	long scanned = -1;
+	start = now_us();
+	for (int i = 0; i < iterations; i++) {
+		scanned = scan(query);
+	}
+	double scan_us = (now_us() - start) / iterations;
+
+	if (found != scanned) {
+		fprintf(stderr, "history_bench: %s found %ld, scanning found %ld\n", name, found, scanned);
+	}
+	printf("{\"bench\": \"history\", \"case\": \"%s\", \"found\": %s, \"iterations\": %d, "
+		"\"search_us\": %.2f, \"scan_us\": %.2f}\n",
+		name, found >= 0 ? "true" : "false", iterations, search_us, scan_us);
+	fflush(stdout);
+}
+
+int main(int argc, char** argv) {
+	int entries = argc > 1 ? atoi(argv[1]) : 1000000;
+	int iterations = argc > 2 ? atoi(argv[2]) : 20;
+
+	char path[] = "/tmp/history_benchXXXXXX";
+	int fd = mkstemp(path);
+	if (fd < 0) {
+		perror("history_bench: mkstemp");
+		return 1;
+	}
+	FILE* file = fdopen(fd, "w");
+	for (int i = 0; i < entries; i++) {
+		if (i % 10 == 0) {
+			fputs("ls -l\n", file); // Repeats, only the newest is kept
+		} else {
+			fprintf(file, templates[i % 5], i);
+			fputc('\n', file);
+		}
+	}
+	fclose(file);
+
+	double start = now_us();
+	histdb_open(path, entries);
+	printf("{\"bench\": \"history\", \"case\": \"load\", \"entries\": %d, \"load_ms\": %.2f}\n",
+		entries, (now_us() - start) / 1e3);
+
+	run("recent", "ls -l", iterations);
+	run("oldest", "'change 5'", iterations);
+	run("middle", "pattern500003 ", iterations);
+	run("no_match", "no such command", iterations);
+
+	unlink(path);
+	return 0;
+}
@@ -0,0 +1,116 @@
+/**
+ * @file parse_bench.c
+ *
+ * Measures parse() throughput over a corpus of representative lines, once
+ * with each tokenizer implementation the CPU supports.
+ *
+ * Usage: parse_bench [seconds per case]
+ * Prints one JSON object per line.
+ */
+
+#include "../parser.h"
+#include "../scan.h"
+#include "../arena.h"
+#include "../vars.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+struct bench_case_t {
+	const char* name;
+	char* line;
+};
+
+static double now_s() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char* repeat(const char* prefix, const char* piece, int count) {
+	size_t len = strlen(prefix) + strlen(piece) * count;
+	char* line = (char*)malloc(len + 1);
+	char* w = stpcpy(line, prefix);
+	for (int i = 0; i < count; i++) {
+		w = stpcpy(w, piece);
+	}
+	return line;
+}
+
+/**
+ * Parse every line of the case over and over for about the given time
+ */
+static void run(const struct bench_case_t* bench, double seconds) {
+	struct arena_t arena;
+	arena_init(&arena, 1 << 14);
+
+	size_t len = strlen(bench->line);
+	char* buf = (char*)malloc(len + 1);
+
+	long lines = 0;
+	double start = now_s();
+	double elapsed;
+	do {
+		// Batches so we aren't reading the clock every line
+		for (int i = 0; i < 64; i++) {
+			// parse() works in place, so it needs a fresh copy every time
+			memcpy(buf, bench->line, len + 1);
+			struct command_t* cmd = new_command(&arena);
+			if (parse(cmd, buf) != kParseOK) {
+				fprintf(stderr, "parse_bench: %s failed to parse\n", bench->name);
+				exit(1);
+			}
+			arena_reset(&arena);
+		}
+		lines += 64;
+		elapsed = now_s() - start;
+	} while (elapsed < seconds);
+
+	printf("{\"bench\": \"parse\", \"case\": \"%s\", \"scan\": \"%s\", \"line_bytes\": %zu, "
+		"\"lines\": %ld, \"seconds\": %.3f, \"mb_per_s\": %.1f, \"lines_per_s\": %.0f, "
+		"\"arena_high_water\": %zu}\n",
+		bench->name, scan_name(), len, lines, elapsed,
+		len * lines / elapsed / 1e6, lines / elapsed, arena.high_water);
+	fflush(stdout);
+
+	free(buf);
+	arena_free(&arena);
+}
+
+int main(int argc, char** argv) {
+	double seconds = argc > 1 ? atof(argv[1]) : 0.5;
+
+	var_set("BENCH_DIR", "/usr/lib", 0);
+	var_set("BENCH_OPT", "-O2", 0);
+	var_set("BENCH_LONG", "/opt/toolchains/some-vendor/gcc-arm-none-eabi/lib/gcc/arm-none-eabi/include", 0);
+
+	struct bench_case_t cases[] = {
+		{"short", strdup("ls -la /usr/local/bin")},
+		{"redirects", strdup("sort -u -k2 < input.txt > output.txt")},
+		// More than 256 arguments, so argv has to grow
+		{"many_args", repeat("cmd", " arg", 1000)},
+		{"quoting", repeat("echo", " \"a \\\"quoted\\\" string\" 'single \\'one\\'' esc\\ aped\\\\", 50)},
+		{"pipeline", repeat("cat < in", " | grep -v foo | sed s/a/b/", 20)},
+		// Generated command lines with hundreds of KB of arguments
+		{"long_args", repeat("cmd", " --some-long-option-name=/a/fairly/long/path/to/some/file.txt", 4000)},
+		// Values that fit where their references were, and ones that don't
+		{"expand", repeat("cc", " $BENCH_OPT -L${BENCH_DIR}/x \"$?\"", 50)},
+		{"expand_growing", repeat("cc", " -I$BENCH_LONG", 50)},
+	};
+
+	const char* impls[] = {"avx2", "sse2", "scalar"};
+	for (int i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+		if (scan_select(impls[i]) < 0) {
+			continue;
+		}
+		for (int j = 0; j < sizeof(cases) / sizeof(cases[0]); j++) {
+			run(&cases[j], seconds);
+		}
+	}
+
+	for (int j = 0; j < sizeof(cases) / sizeof(cases[0]); j++) {
+		free(cases[j].line);
+	}
+	return 0;
+}
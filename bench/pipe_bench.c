@@ -0,0 +1,98 @@
+/**
+ * @file pipe_bench.c
+ *
+ * Measures how fast data moves through a producer | consumer pipeline run
+ * by the shell, for different values of $PIPESIZE. The shell is started with
+ * -c once per run, and the whole run is timed.
+ *
+ * Usage: pipe_bench [shell] [MB per run] [iterations] [size ...]
+ * Sizes are anything $PIPESIZE takes, "default" leaves it unset.
+ * Prints one JSON object per line.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/wait.h>
+
+extern char** environ;
+
+static double now_us() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/**
+ * Run one pipeline through the shell
+ * @return How long it took, in microseconds
+ */
+static double run_once(const char* shell, const char* script) {
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	// set says what it's doing, we don't want to hear it
+	posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+
+	char* argv[] = {(char*)shell, "-c", (char*)script, NULL};
+	double start = now_us();
+	pid_t pid;
+	int err = posix_spawn(&pid, shell, &actions, NULL, argv, environ);
+	posix_spawn_file_actions_destroy(&actions);
+	if (err != 0) {
+		fprintf(stderr, "pipe_bench: can't run %s: %s\n", shell, strerror(err));
+		exit(1);
+	}
+
+	int status;
+	waitpid(pid, &status, 0);
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		fprintf(stderr, "pipe_bench: pipeline failed: %s\n", script);
+		exit(1);
+	}
+	return now_us() - start;
+}
+
+static void run(const char* shell, const char* size, size_t mb, int iterations) {
+	char script[512];
+	char* w = script;
+	if (strcmp(size, "default") != 0) {
+		w += sprintf(w, "set PIPESIZE = %s\n", size);
+	}
+	sprintf(w, "head -c %zu /dev/zero | cat > /dev/null", mb << 20);
+
+	// Warm up, so the page cache and the binaries are hot
+	run_once(shell, script);
+
+	double total = 0;
+	double best = 0;
+	for (int i = 0; i < iterations; i++) {
+		double us = run_once(shell, script);
+		total += us;
+		if (i == 0 || us < best) {
+			best = us;
+		}
+	}
+
+	printf("{\"bench\": \"pipe\", \"pipe_size\": \"%s\", \"mb\": %zu, \"iterations\": %d, "
+		"\"mean_ms\": %.1f, \"best_ms\": %.1f, \"mb_per_s\": %.0f}\n",
+		size, mb, iterations, total / iterations / 1e3, best / 1e3,
+		mb / (best / 1e6));
+	fflush(stdout);
+}
+
+int main(int argc, char** argv) {
+	const char* shell = argc > 1 ? argv[1] : "./shell";
+	size_t mb = argc > 2 ? strtoul(argv[2], NULL, 10) : 1024;
+	int iterations = argc > 3 ? atoi(argv[3]) : 5;
+
+	const char* default_sizes[] = {"default", "4k", "64k", "256k", "1m"};
+	int size_count = argc > 4 ? argc - 4 : sizeof(default_sizes) / sizeof(default_sizes[0]);
+	for (int i = 0; i < size_count; i++) {
+		run(shell, argc > 4 ? argv[i + 4] : default_sizes[i], mb, iterations);
+	}
+	return 0;
+}
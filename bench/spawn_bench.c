@@ -0,0 +1,107 @@
+/**
+ * @file spawn_bench.c
+ *
+ * Measures how long it takes to launch and reap /bin/true with fork+execve
+ * (how the shell used to launch externals), with posix_spawn (how it does
+ * now) and through the zygote (how it does with $SHELL_ZYGOTE set), while
+ * the process holds a given amount of touched heap, since that's what makes
+ * fork slow in a long running shell.
+ *
+ * Usage: spawn_bench [iterations] [heap MB ...]
+ * Prints one JSON object per line.
+ */
+
+#include "../zygote.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <spawn.h>
+#include <sys/wait.h>
+
+extern char** environ;
+
+static char* true_argv[] = {"true", NULL};
+
+static double now_us() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void launch_fork(const char* path) {
+	pid_t pid = fork();
+	if (pid == 0) {
+		execve(path, true_argv, environ);
+		_exit(127);
+	}
+	waitpid(pid, NULL, 0);
+}
+
+static void launch_spawn(const char* path) {
+	pid_t pid;
+	if (posix_spawn(&pid, path, NULL, NULL, true_argv, environ) == 0) {
+		waitpid(pid, NULL, 0);
+	}
+}
+
+static void launch_zygote(const char* path) {
+	pid_t pid = zygote_spawn(path, true_argv, environ, "/", STDIN_FILENO, STDOUT_FILENO, 0);
+	zygote_release();
+	struct zygote_status_t status;
+	while (pid > 0 && zygote_next_status(&status, 1) && status.pid != pid) {}
+}
+
+static int compare_double(const void* a, const void* b) {
+	double x = *(const double*)a, y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+static void run(const char* method, void (*launch)(const char*), const char* path, int iterations, size_t heap_mb) {
+	double* samples = (double*)malloc(sizeof(double) * iterations);
+	double total = 0;
+	for (int i = 0; i < iterations; i++) {
+		double start = now_us();
+		launch(path);
+		samples[i] = now_us() - start;
+		total += samples[i];
+	}
+	qsort(samples, iterations, sizeof(double), compare_double);
+	printf("{\"bench\": \"launch\", \"method\": \"%s\", \"heap_mb\": %zu, \"iterations\": %d, "
+		"\"mean_us\": %.1f, \"p50_us\": %.1f, \"p99_us\": %.1f}\n",
+		method, heap_mb, iterations, total / iterations,
+		samples[iterations / 2], samples[iterations * 99 / 100]);
+	fflush(stdout);
+	free(samples);
+}
+
+int main(int argc, char** argv) {
+	int iterations = argc > 1 ? atoi(argv[1]) : 500;
+	const char* path = access("/bin/true", X_OK) == 0 ? "/bin/true" : "/usr/bin/true";
+
+	size_t default_heaps[] = {0, 64, 512};
+	size_t heap_count = argc > 2 ? argc - 2 : sizeof(default_heaps) / sizeof(default_heaps[0]);
+
+	// Before the heap, like the shell starts it before it's grown
+	int zygote = zygote_start() == 0;
+
+	char* heap = NULL;
+	for (size_t i = 0; i < heap_count; i++) {
+		size_t heap_mb = argc > 2 ? strtoul(argv[i + 2], NULL, 10) : default_heaps[i];
+		free(heap);
+		heap = NULL;
+		if (heap_mb) {
+			// Touch every page so fork has real page tables to copy
+			heap = (char*)malloc(heap_mb << 20);
+			memset(heap, 1, heap_mb << 20);
+		}
+		run("fork", launch_fork, path, iterations, heap_mb);
+		run("posix_spawn", launch_spawn, path, iterations, heap_mb);
+		if (zygote) {
+			run("zygote", launch_zygote, path, iterations, heap_mb);
+		}
+	}
+	free(heap);
+	return 0;
+}
@@ -7,6 +7,18 @@
 
 #include "utility.h"
 #include "builtins.h"
+#include "cmdhash.h"
+#include "prompt.h"
+#include "execute.h"
+#include "jobs.h"
+#include "stats.h"
+#include "trace.h"
+#include "vars.h"
+#include "histdb.h"
+#include "complete.h"
+#include "rlimits.h"
+#include "cmdcache.h"
+#include "arena.h"
 #include <string.h>
 #include <limits.h>
 #include <unistd.h>
@@ -16,23 +28,56 @@
 #include <stdio.h>
 
 struct builtin_t builtins[] = {
-	{"set", builtin_set},
-	{"delete", builtin_delete},
-	{"print", builtin_print},
-	{"cd", builtin_cd},
-	{"pwd", builtin_pwd},
-	{"help", builtin_help},
-	{"exit", builtin_exit},
+#define BUILTIN(name, func) {#name, func},
+#include "builtins.def"
+#undef BUILTIN
 	{NULL, NULL}
 };
 
-int find_builtin(struct command_t* cmd) {
-	for (int i = 0; builtins[i].name != NULL; i++) {
-		if (strcmp(builtins[i].name, cmd->argv[0]) == 0) {
-			return i; // It's a builtin, return its index
-		}
+#include "builtins_lookup.h"
+
+/**
+ * Find the builtin with the given name
+ * @param name Command name
+ * @return The builtin, or NULL if there isn't one by that name
+ */
+const struct builtin_t* find_builtin(const char* name) {
+	STATS_START(start);
+	int idx = lookup_builtin(name);
+	STATS_STOP(kStatFindBuiltin, start);
+	return idx < 0 ? NULL : &builtins[idx];
+}
+
+/**
+ * Whether a builtin is only any use run in the shell itself, because what
+ * it does is change the shell's variables, directory, jobs or caches
+ */
+int builtin_changes_shell(const struct builtin_t* builtin) {
+	builtin_func_t func = builtin->func;
+	return func == builtin_set || func == builtin_delete || func == builtin_export ||
+		func == builtin_cd || func == builtin_hash || func == builtin_jobs ||
+		func == builtin_fg || func == builtin_bg || func == builtin_wait ||
+		func == builtin_limit || func == builtin_exit;
+}
+
+/**
+ * Let anything caching a variable's value know that it changed
+ * @param name Name of the variable that was set or deleted
+ */
+static void variable_changed(const char* name) {
+	if (strcmp(name, "PATH") == 0) {
+		cmdhash_clear();
+		complete_invalidate();
+	} else if (strcmp(name, "HOME") == 0 || strcmp(name, "PS1") == 0) {
+		prompt_invalidate();
+	} else if (strcmp(name, "PIPESIZE") == 0) {
+		pipe_size_changed();
+	} else if (strcmp(name, "SHELL_TRACE") == 0) {
+		trace_changed();
+	} else if (strcmp(name, "HISTSIZE") == 0) {
+		const char* size = var_get("HISTSIZE");
+		histdb_set_cap(size && atol(size) > 0 ? atol(size) : HISTDB_DEFAULT_SIZE);
 	}
-	return -1; // Not a builtin
 }
 
 status_t builtin_set(struct command_t* cmd) {
@@ -51,15 +96,21 @@ status_t builtin_set(struct command_t* cmd) {
 		//
 		// I probably could have gotten away with replicating normal shell behavior
 		// since I doubt it'll be tested that harshly... Eh.
-		char* s = cmd->argv[1];
-		while (s < cmd->argv[cmd->argc - 1]) {
-			if (*s == '\0') {
-				*s = ' ';
-			}
-			s++;
+		//
+		// Expanded arguments don't have to be next to each other in the
+		// line, so join them in a copy rather than patching the NULs.
+		size_t len = 0;
+		for (int i = 1; i < cmd->argc; i++) {
+			len += strlen(cmd->argv[i]) + 1;
 		}
+		char* args = (char*)arena_alloc(cmd->arena, len);
+		char* w = args;
+		for (int i = 1; i < cmd->argc; i++) {
+			w = stpcpy(w, cmd->argv[i]);
+			*w++ = ' ';
+		}
+		w[-1] = '\0';
 
-		char* args = cmd->argv[1];
 		// Verify we have a = sign
 		if (strchr(args, '=') != NULL) {
 			// This strtok_r will never return NULL because we know we
@@ -69,7 +120,8 @@ status_t builtin_set(struct command_t* cmd) {
 			// be a zero length string
 			char* val = trimSpaces(args);
 
-			if (setenv(var, val, 1) == 0) {
+			if (var_set(var, val, 0) == 0) {
+				variable_changed(var);
 				printf("Setting %s = %s\n", var, val);
 			} else {
 				printf("Error setting variable: %s\n", strerror(errno));
@@ -88,7 +140,8 @@ status_t builtin_set(struct command_t* cmd) {
 
 status_t builtin_delete(struct command_t* cmd) {
 	if (cmd->argc == 2) {
-		unsetenv(cmd->argv[1]);
+		var_delete(cmd->argv[1]);
+		variable_changed(cmd->argv[1]);
 		printf("Deleting %s\n", cmd->argv[1]);
 	} else {
 		printf("Error: Usage: delete varname\n");
@@ -99,7 +152,7 @@ status_t builtin_delete(struct command_t* cmd) {
 
 status_t builtin_print(struct command_t* cmd) {
 	if (cmd->argc == 2) {
-		char* val = getenv(cmd->argv[1]);
+		const char* val = var_get(cmd->argv[1]);
 		if (val == NULL) {
 			printf("%s is unset\n", cmd->argv[1]);
 		} else {
@@ -112,34 +165,207 @@ status_t builtin_print(struct command_t* cmd) {
 	return BUILTIN_OK;
 }
 
+status_t builtin_export(struct command_t* cmd) {
+	if (cmd->argc == 1) {
+		vars_print_exported();
+		return BUILTIN_OK;
+	}
+	status_t ret = BUILTIN_OK;
+	for (int i = 1; i < cmd->argc; i++) {
+		if (var_export(cmd->argv[i]) < 0) {
+			printf("export: %s is unset\n", cmd->argv[i]);
+			ret = BUILTIN_ERROR;
+		}
+	}
+	return ret;
+}
+
 status_t builtin_cd(struct command_t* cmd) {
-	char* path;
+	const char* path;
+	int print_dir = 0;
 	if (cmd->argc == 1) {
 		// We want to change to our home directory
 		// if we have no arguments
-		if ((path = getenv("HOME")) == NULL) {
+		if ((path = var_get("HOME")) == NULL) {
 			path = ".";
 		}
 	} else if (cmd->argc == 2) {
 		path = cmd->argv[1];
+		if (strcmp(path, "-") == 0) {
+			// Back to where we were before
+			if ((path = var_get("OLDPWD")) == NULL) {
+				printf("cd: OLDPWD not set\n");
+				return BUILTIN_ERROR;
+			}
+			print_dir = 1;
+		}
 	} else {
 		printf("cd: too many arguments\n");
 		return BUILTIN_ERROR;
 	}
 
-	if (chdir(path) == -1) {
+	char* old_dir = strdup(currentDir());
+	if (changeDir(path) == -1) {
 		printf("cd: %s\n", strerror(errno));
+		free(old_dir);
 		return BUILTIN_ERROR;
 	}
 
+	var_set("OLDPWD", old_dir, 1);
+	var_set("PWD", currentDir(), 1);
+	free(old_dir);
+	prompt_invalidate();
+
+	if (print_dir) {
+		printf("%s\n", currentDir());
+	}
+
 	return BUILTIN_OK;
 }
 
 status_t builtin_pwd(struct command_t* cmd) {
-	// Correctly handle extremely long paths
-	char* buf = getPwd();
-	printf("%s\n", buf);
-	free(buf);
+	printf("%s\n", currentDir());
+	return BUILTIN_OK;
+}
+
+status_t builtin_hash(struct command_t* cmd) {
+	if (cmd->argc == 1) {
+		cmdhash_print();
+	} else if (cmd->argc == 2 && strcmp(cmd->argv[1], "-r") == 0) {
+		cmdhash_clear();
+	} else {
+		status_t ret = BUILTIN_OK;
+		for (int i = 1; i < cmd->argc; i++) {
+			if (cmdhash_add(cmd->argv[i]) < 0) {
+				printf("hash: %s: not found\n", cmd->argv[i]);
+				ret = BUILTIN_ERROR;
+			}
+		}
+		return ret;
+	}
+	return BUILTIN_OK;
+}
+
+status_t builtin_jobs(struct command_t* cmd) {
+	jobs_print();
+	return BUILTIN_OK;
+}
+
+/**
+ * Continue a job for fg and bg
+ */
+static status_t continue_job(struct command_t* cmd, int foreground) {
+	if (cmd->argc > 2) {
+		printf("Error: Usage: %s [%%job]\n", cmd->argv[0]);
+		return BUILTIN_ERROR;
+	}
+	jobs_update();
+	struct job_t* job = job_find(cmd->argc == 2 ? cmd->argv[1] : NULL);
+	if (job == NULL) {
+		printf("%s: no such job\n", cmd->argv[0]);
+		return BUILTIN_ERROR;
+	}
+	if (!foreground && job->timeout > 0) {
+		// Nothing would be waiting to enforce it
+		printf("%s: job has a timeout, it can only run in the foreground\n", cmd->argv[0]);
+		return BUILTIN_ERROR;
+	}
+	builtin_status = job_continue(job, foreground);
+	return BUILTIN_OK;
+}
+
+status_t builtin_fg(struct command_t* cmd) {
+	return continue_job(cmd, 1);
+}
+
+status_t builtin_bg(struct command_t* cmd) {
+	return continue_job(cmd, 0);
+}
+
+status_t builtin_wait(struct command_t* cmd) {
+	if (cmd->argc == 1) {
+		builtin_status = jobs_wait_all();
+		return BUILTIN_OK;
+	}
+
+	jobs_update();
+	for (int i = 1; i < cmd->argc; i++) {
+		struct job_t* job = job_find(cmd->argv[i]);
+		if (job == NULL) {
+			printf("wait: %s: no such job\n", cmd->argv[i]);
+			builtin_status = 127;
+		} else {
+			builtin_status = job_wait(job, 0);
+		}
+	}
+	return BUILTIN_OK;
+}
+
+status_t builtin_stats(struct command_t* cmd) {
+	int json = 0;
+	for (int i = 1; i < cmd->argc; i++) {
+		if (strcmp(cmd->argv[i], "-j") == 0) {
+			json = 1;
+		} else if (strcmp(cmd->argv[i], "-r") == 0) {
+			stats_reset();
+			cmdcache_reset_counters();
+			return BUILTIN_OK;
+		} else {
+			printf("Error: Usage: stats [-j | -r]\n");
+			return BUILTIN_ERROR;
+		}
+	}
+	stats_print(json);
+	cmdcache_print(json);
+	arena_print(&line_arena, "line_arena", json);
+	return BUILTIN_OK;
+}
+
+status_t builtin_history(struct command_t* cmd) {
+	long count = LONG_MAX;
+	if (cmd->argc > 2 || (cmd->argc == 2 && (count = atol(cmd->argv[1])) <= 0)) {
+		printf("Error: Usage: history [count]\n");
+		return BUILTIN_ERROR;
+	}
+	// Back up count entries, then print them oldest first
+	long first = -1, shown = 0;
+	for (long i = histdb_newest(); i >= 0 && shown < count; i = histdb_previous(i)) {
+		first = i;
+		shown++;
+	}
+	long number = 1;
+	for (long i = first; i >= 0; i = histdb_next(i)) {
+		size_t len;
+		const char* line = histdb_line(i, &len);
+		printf("%5ld  %.*s\n", number++, (int)len, line);
+	}
+	return BUILTIN_OK;
+}
+
+/**
+ * limit with options sets the limits everything run after it gets, and with
+ * none prints them. A limit prefix on a command is taken off by the parser,
+ * so it never gets here.
+ */
+status_t builtin_limit(struct command_t* cmd) {
+	if (cmd->argc == 2 && strcmp(cmd->argv[1], "-r") == 0) {
+		memset(&limits_default, 0, sizeof(limits_default));
+		return BUILTIN_OK;
+	}
+	if (cmd->argc == 1) {
+		char text[256];
+		limits_describe(&limits_default, text, sizeof(text));
+		printf("%s\n", text[0] ? text : "No limits");
+		return BUILTIN_OK;
+	}
+
+	struct limits_t limits;
+	memset(&limits, 0, sizeof(limits));
+	if (limits_parse(&limits, cmd->argv + 1, 1) < 0) {
+		printf("Error: Usage: limit [-t secs] [-v bytes] [-n files] [-u procs] [-N nice] [-I class[:level]] [command ...]\n");
+		return BUILTIN_ERROR;
+	}
+	limits_merge(&limits_default, &limits);
 	return BUILTIN_OK;
 }
 
@@ -147,8 +373,20 @@ status_t builtin_help(struct command_t* cmd) {
 	printf("set varname = somevalue\n");
 	printf("delete varname\n");
 	printf("print varname\n");
+	printf("export [varname ...]\n");
 	printf("pwd\n");
-	printf("cd [dir]\n");
+	printf("cd [dir | -]\n");
+	printf("hash [-r] [name ...]\n");
+	printf("jobs\n");
+	printf("fg [%%job]\n");
+	printf("bg [%%job]\n");
+	printf("wait [%%job | pid ...]\n");
+	printf("parallel [-j jobs] command [arg ...] [::: input ...]\n");
+	printf("stats [-j | -r]\n");
+	printf("history [count]\n");
+	printf("limit [-t secs] [-v bytes] [-n files] [-u procs] [-N nice] [-I class[:level]] [-r] [command ...]\n");
+	printf("time pipeline\n");
+	printf("timeout secs pipeline\n");
 	printf("exit\n");
 	return BUILTIN_OK;
 }
@@ -11,13 +11,26 @@ struct builtin_t {
 	builtin_func_t func;
 };
 
-int find_builtin(struct command_t* cmd);
+extern struct builtin_t builtins[]; // In help order, ends with a NULL name
+
+const struct builtin_t* find_builtin(const char* name);
+int builtin_changes_shell(const struct builtin_t* builtin);
 
 status_t builtin_set(struct command_t* cmd);
 status_t builtin_delete(struct command_t* cmd);
 status_t builtin_print(struct command_t* cmd);
+status_t builtin_export(struct command_t* cmd);
 status_t builtin_cd(struct command_t* cmd);
 status_t builtin_pwd(struct command_t* cmd);
+status_t builtin_hash(struct command_t* cmd);
+status_t builtin_jobs(struct command_t* cmd);
+status_t builtin_fg(struct command_t* cmd);
+status_t builtin_bg(struct command_t* cmd);
+status_t builtin_wait(struct command_t* cmd);
+status_t builtin_parallel(struct command_t* cmd); // In parallel.c
+status_t builtin_stats(struct command_t* cmd);
+status_t builtin_history(struct command_t* cmd);
+status_t builtin_limit(struct command_t* cmd);
 status_t builtin_help(struct command_t* cmd);
 status_t builtin_exit(struct command_t* cmd);
 
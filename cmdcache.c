@@ -0,0 +1,250 @@
+/**
+ * @file cmdcache.c
+ *
+ * Remembers what recent lines parsed to, so a line that comes up again
+ * doesn't have to be parsed again. Generated scripts can repeat the same
+ * few lines thousands of times. Only lines that always parse the same way
+ * are kept, which means none with anything to expand: $ can change with a
+ * variable and a glob with the directory.
+ *
+ * Each entry is one allocation holding the line and a copy of its command
+ * chain. The copy is never handed out, since the caller's command has to
+ * come from its arena like a freshly parsed one. Instead the commands and
+ * argv arrays are copied into it, still pointing at the cached strings,
+ * which nothing writes to after parsing.
+ */
+
+#include "cmdcache.h"
+#include "rlimits.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdalign.h>
+
+#define CMDCACHE_ENTRIES 256
+#define CMDCACHE_BUCKETS 512 // Power of two
+#define CMDCACHE_MAX_LINE 4096 // Longer lines are generated, not repeated
+#define ALIGN(n) (((n) + alignof(max_align_t) - 1) & ~(alignof(max_align_t) - 1))
+
+struct cmdcache_entry_t {
+	uint64_t hash;
+	size_t len;
+	char* line;
+	struct command_t* cmd;
+	struct cmdcache_entry_t* next;  // In the same bucket
+	struct cmdcache_entry_t* newer; // Least recently used order
+	struct cmdcache_entry_t* older;
+};
+
+static struct cmdcache_entry_t* buckets[CMDCACHE_BUCKETS];
+static struct cmdcache_entry_t* newest = NULL;
+static struct cmdcache_entry_t* oldest = NULL;
+static size_t entry_count = 0;
+
+static struct {
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long skipped; // Lines that couldn't be cached
+	unsigned long evicted;
+} counters;
+
+static uint64_t hash_line(const char* line, size_t len) {
+	uint64_t h = 14695981039346656037ULL;
+	for (size_t i = 0; i < len; i++) {
+		h = (h ^ (unsigned char)line[i]) * 1099511628211ULL;
+	}
+	return h;
+}
+
+/**
+ * @return Whether line always parses to the same thing, so it can be cached
+ */
+int cmdcache_cacheable(const char* line) {
+	size_t len = strcspn(line, "$*?[");
+	if (line[len] != '\0' || len > CMDCACHE_MAX_LINE) {
+		counters.skipped++;
+		return 0;
+	}
+	return 1;
+}
+
+static void unlink_lru(struct cmdcache_entry_t* entry) {
+	if (entry->newer) {
+		entry->newer->older = entry->older;
+	} else {
+		newest = entry->older;
+	}
+	if (entry->older) {
+		entry->older->newer = entry->newer;
+	} else {
+		oldest = entry->newer;
+	}
+}
+
+static void push_newest(struct cmdcache_entry_t* entry) {
+	entry->older = newest;
+	entry->newer = NULL;
+	if (newest) {
+		newest->newer = entry;
+	} else {
+		oldest = entry;
+	}
+	newest = entry;
+}
+
+static void evict(struct cmdcache_entry_t* entry) {
+	struct cmdcache_entry_t** link = &buckets[entry->hash & (CMDCACHE_BUCKETS - 1)];
+	while (*link != entry) {
+		link = &(*link)->next;
+	}
+	*link = entry->next;
+	unlink_lru(entry);
+	free(entry);
+	entry_count--;
+}
+
+/**
+ * Get what a line parsed to last time
+ * @param line Line as read, before parse() changed it
+ * @param arena Where to put the command, like new_command()
+ * @return The command, or NULL if the line isn't cached
+ */
+struct command_t* cmdcache_lookup(const char* line, struct arena_t* arena) {
+	size_t len = strlen(line);
+	uint64_t hash = hash_line(line, len);
+	struct cmdcache_entry_t* entry = buckets[hash & (CMDCACHE_BUCKETS - 1)];
+	while (entry && (entry->hash != hash || entry->len != len || memcmp(entry->line, line, len) != 0)) {
+		entry = entry->next;
+	}
+	if (entry == NULL) {
+		counters.misses++;
+		return NULL;
+	}
+	counters.hits++;
+	unlink_lru(entry);
+	push_newest(entry);
+
+	struct command_t* first = NULL;
+	struct command_t** link = &first;
+	for (const struct command_t* cached = entry->cmd; cached; cached = cached->pipe) {
+		struct command_t* cmd = (struct command_t*)arena_alloc(arena, sizeof(struct command_t));
+		*cmd = *cached;
+		cmd->arena = arena;
+		cmd->argv = (char**)arena_alloc(arena, sizeof(char*) * cmd->argc_max);
+		memcpy(cmd->argv, cached->argv, sizeof(char*) * (cmd->argc + 1));
+		*link = cmd;
+		link = &cmd->pipe;
+	}
+	return first;
+}
+
+static size_t string_size(const char* s) {
+	return s ? strlen(s) + 1 : 0;
+}
+
+static char* copy_string(char** w, const char* s) {
+	if (s == NULL) {
+		return NULL;
+	}
+	size_t size = strlen(s) + 1;
+	char* copy = (char*)memcpy(*w, s, size);
+	*w += size;
+	return copy;
+}
+
+/**
+ * Remember what a line parsed to, forgetting the least recently used line
+ * if we're full
+ * @param line Line as read, before parse() changed it
+ * @param cmd What it parsed to, without errors
+ */
+void cmdcache_store(const char* line, const struct command_t* cmd) {
+	size_t len = strlen(line);
+
+	// Everything goes in one block: the entry, then each command and its
+	// argv, then the limits, then the strings
+	size_t fixed = ALIGN(sizeof(struct cmdcache_entry_t));
+	size_t strings = len + 1;
+	for (const struct command_t* stage = cmd; stage; stage = stage->pipe) {
+		fixed += ALIGN(sizeof(struct command_t)) + ALIGN(sizeof(char*) * (stage->argc + 1));
+		fixed += stage->limits ? ALIGN(sizeof(struct limits_t)) : 0;
+		for (size_t i = 0; i < stage->argc; i++) {
+			strings += strlen(stage->argv[i]) + 1;
+		}
+		strings += string_size(stage->in_file) + string_size(stage->out_file);
+	}
+	char* block = (char*)malloc(fixed + strings);
+	char* w = block;
+	char* strings_w = block + fixed;
+
+	struct cmdcache_entry_t* entry = (struct cmdcache_entry_t*)w;
+	w += ALIGN(sizeof(struct cmdcache_entry_t));
+	entry->hash = hash_line(line, len);
+	entry->len = len;
+	entry->line = copy_string(&strings_w, line);
+
+	struct command_t** link = &entry->cmd;
+	for (const struct command_t* stage = cmd; stage; stage = stage->pipe) {
+		struct command_t* copy = (struct command_t*)w;
+		w += ALIGN(sizeof(struct command_t));
+		*copy = *stage;
+		copy->arena = NULL; // Never used, lookups hand out copies
+		copy->argc_max = stage->argc + 1;
+		copy->argv = (char**)w;
+		w += ALIGN(sizeof(char*) * (stage->argc + 1));
+		for (size_t i = 0; i < stage->argc; i++) {
+			copy->argv[i] = copy_string(&strings_w, stage->argv[i]);
+		}
+		copy->argv[stage->argc] = NULL;
+		copy->in_file = copy_string(&strings_w, stage->in_file);
+		copy->out_file = copy_string(&strings_w, stage->out_file);
+		if (stage->limits) {
+			copy->limits = (struct limits_t*)memcpy(w, stage->limits, sizeof(struct limits_t));
+			w += ALIGN(sizeof(struct limits_t));
+		}
+		*link = copy;
+		link = &copy->pipe;
+	}
+	*link = NULL;
+
+	if (entry_count == CMDCACHE_ENTRIES) {
+		evict(oldest);
+		counters.evicted++;
+	}
+	struct cmdcache_entry_t** bucket = &buckets[entry->hash & (CMDCACHE_BUCKETS - 1)];
+	entry->next = *bucket;
+	*bucket = entry;
+	push_newest(entry);
+	entry_count++;
+}
+
+/**
+ * Forget every line
+ */
+void cmdcache_clear() {
+	while (oldest) {
+		evict(oldest);
+	}
+}
+
+void cmdcache_reset_counters() {
+	memset(&counters, 0, sizeof(counters));
+}
+
+/**
+ * Print how well the cache is doing, after the stats table
+ * @param json As a JSON object instead
+ */
+void cmdcache_print(int json) {
+	if (json) {
+		printf("{\"stat\": \"parse_cache\", \"hits\": %lu, \"misses\": %lu, \"skipped\": %lu, "
+			"\"evicted\": %lu, \"entries\": %zu, \"capacity\": %d}\n",
+			counters.hits, counters.misses, counters.skipped, counters.evicted,
+			entry_count, CMDCACHE_ENTRIES);
+	} else {
+		printf("parse cache: %lu hits, %lu misses, %lu not cacheable, %lu evicted, %zu/%d lines\n",
+			counters.hits, counters.misses, counters.skipped, counters.evicted,
+			entry_count, CMDCACHE_ENTRIES);
+	}
+}
@@ -0,0 +1,18 @@
+/**
+ * @file cmdcache.h
+ */
+
+#ifndef _CMDCACHE_H
+#define _CMDCACHE_H
+
+#include "parser.h"
+#include "arena.h"
+
+int cmdcache_cacheable(const char* line);
+struct command_t* cmdcache_lookup(const char* line, struct arena_t* arena);
+void cmdcache_store(const char* line, const struct command_t* cmd);
+void cmdcache_clear();
+void cmdcache_reset_counters();
+void cmdcache_print(int json);
+
+#endif // _CMDCACHE_H
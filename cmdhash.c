@@ -0,0 +1,201 @@
+/**
+ * @file cmdhash.c
+ *
+ * Remembers where external commands live so we only have to walk $PATH
+ * the first time a command is run, like the hash table in sh/bash.
+ */
+
+#include "cmdhash.h"
+#include "vars.h"
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <sys/stat.h>
+
+#define CMDHASH_BUCKETS 64
+
+struct cmdhash_entry_t {
+	char* name;
+	char* path;
+	unsigned long hits;
+	struct cmdhash_entry_t* next;
+};
+
+static struct cmdhash_entry_t* buckets[CMDHASH_BUCKETS];
+
+static unsigned int hash_name(const char* name) {
+	unsigned int h = 5381;
+	while (*name) {
+		h = h * 33 + (unsigned char)*name++;
+	}
+	return h % CMDHASH_BUCKETS;
+}
+
+/**
+ * Walk $PATH looking for an executable called name
+ * @param name Command name, must not contain a slash
+ * @return Newly allocated path to the executable, or NULL if not found
+ */
+static char* search_path(const char* name) {
+	const char* dir = var_get("PATH");
+	if (dir == NULL) {
+		// Same default execvp uses
+		dir = "/bin:/usr/bin";
+	}
+
+	char buf[PATH_MAX];
+	size_t name_len = strlen(name);
+	while (1) {
+		const char* end = strchr(dir, ':');
+		if (end == NULL) {
+			end = dir + strlen(dir);
+		}
+		size_t dir_len = end - dir;
+		if (dir_len == 0) {
+			// An empty entry means the current directory
+			dir = ".";
+			dir_len = 1;
+		}
+
+		if (dir_len + name_len + 2 <= sizeof(buf)) {
+			memcpy(buf, dir, dir_len);
+			buf[dir_len] = '/';
+			memcpy(buf + dir_len + 1, name, name_len + 1);
+
+			struct stat st;
+			if (stat(buf, &st) == 0 && S_ISREG(st.st_mode) && access(buf, X_OK) == 0) {
+				return strdup(buf);
+			}
+		}
+
+		if (*end == '\0') {
+			break;
+		}
+		dir = end + 1;
+	}
+	return NULL;
+}
+
+static struct cmdhash_entry_t* find_entry(const char* name, unsigned int bucket) {
+	struct cmdhash_entry_t* entry = buckets[bucket];
+	while (entry && strcmp(entry->name, name) != 0) {
+		entry = entry->next;
+	}
+	return entry;
+}
+
+static void remove_entry(struct cmdhash_entry_t* entry, unsigned int bucket) {
+	struct cmdhash_entry_t** link = &buckets[bucket];
+	while (*link != entry) {
+		link = &(*link)->next;
+	}
+	*link = entry->next;
+	free(entry->name);
+	free(entry->path);
+	free(entry);
+}
+
+/**
+ * Find the full path of a command, searching $PATH only on a cache miss or
+ * when the remembered executable has been moved or removed since
+ * @param name Command name
+ * @return Path to execute, or NULL if the command couldn't be found. The
+ *         returned string stays valid until the next cmdhash_lookup() or
+ *         cmdhash_clear()
+ */
+const char* cmdhash_lookup(const char* name) {
+	if (strchr(name, '/') != NULL) {
+		// Explicit paths aren't looked up or remembered
+		return name;
+	}
+
+	unsigned int bucket = hash_name(name);
+	struct cmdhash_entry_t* entry = find_entry(name, bucket);
+	if (entry) {
+		// One access() is still far cheaper than walking $PATH, and saves
+		// the user from a hash -r every time something gets reinstalled
+		if (access(entry->path, X_OK) == 0) {
+			entry->hits++;
+			return entry->path;
+		}
+		remove_entry(entry, bucket);
+	}
+
+	char* path = search_path(name);
+	if (path == NULL) {
+		return NULL;
+	}
+
+	entry = (struct cmdhash_entry_t*)malloc(sizeof(struct cmdhash_entry_t));
+	entry->name = strdup(name);
+	entry->path = path;
+	entry->hits = 1;
+	entry->next = buckets[bucket];
+	buckets[bucket] = entry;
+	return path;
+}
+
+/**
+ * Search $PATH for a command and remember it, replacing any old location
+ * @param name Command name
+ * @return 0 on success, -1 if the command couldn't be found
+ */
+int cmdhash_add(const char* name) {
+	if (strchr(name, '/') != NULL) {
+		return 0;
+	}
+
+	char* path = search_path(name);
+	if (path == NULL) {
+		return -1;
+	}
+
+	unsigned int bucket = hash_name(name);
+	struct cmdhash_entry_t* entry = find_entry(name, bucket);
+	if (entry) {
+		free(entry->path);
+	} else {
+		entry = (struct cmdhash_entry_t*)malloc(sizeof(struct cmdhash_entry_t));
+		entry->name = strdup(name);
+		entry->next = buckets[bucket];
+		buckets[bucket] = entry;
+	}
+	entry->path = path;
+	entry->hits = 0;
+	return 0;
+}
+
+/**
+ * Forget every remembered location, e.g. because $PATH changed
+ */
+void cmdhash_clear() {
+	for (int i = 0; i < CMDHASH_BUCKETS; i++) {
+		struct cmdhash_entry_t* entry = buckets[i];
+		while (entry) {
+			struct cmdhash_entry_t* next = entry->next;
+			free(entry->name);
+			free(entry->path);
+			free(entry);
+			entry = next;
+		}
+		buckets[i] = NULL;
+	}
+}
+
+void cmdhash_print() {
+	int empty = 1;
+	for (int i = 0; i < CMDHASH_BUCKETS; i++) {
+		for (struct cmdhash_entry_t* entry = buckets[i]; entry; entry = entry->next) {
+			if (empty) {
+				printf("hits\tcommand\n");
+				empty = 0;
+			}
+			printf("%4lu\t%s\n", entry->hits, entry->path);
+		}
+	}
+	if (empty) {
+		printf("hash: hash table empty\n");
+	}
+}
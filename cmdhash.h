@@ -0,0 +1,13 @@
+/**
+ * @file cmdhash.h
+ */
+
+#ifndef _CMDHASH_H
+#define _CMDHASH_H
+
+const char* cmdhash_lookup(const char* name);
+int cmdhash_add(const char* name);
+void cmdhash_clear();
+void cmdhash_print();
+
+#endif // _CMDHASH_H
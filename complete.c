@@ -0,0 +1,250 @@
+/**
+ * @file complete.c
+ *
+ * Command name completion. Every builtin and every executable in $PATH goes
+ * into a prefix trie, built the first time it's needed, so completing a
+ * prefix only looks at the names that start with it. The trie is thrown
+ * away when $PATH is set or one of its directories changes, which we can
+ * tell from their mtimes without reading them again.
+ */
+
+#define _GNU_SOURCE // strchrnul
+#include "complete.h"
+#include "builtins.h"
+#include "vars.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// Nodes are indexes into one array rather than pointers, which keeps them
+// small and in one place. Node 0 is the root, so 0 also means "none".
+struct trie_node_t {
+	uint32_t child;   // First child, children are sorted by c
+	uint32_t sibling; // Next child of our parent
+	unsigned char c;
+	uint8_t terminal; // A name ends here
+};
+
+struct path_dir_t {
+	char* path;
+	struct timespec mtime;
+};
+
+static struct trie_node_t* nodes = NULL;
+static size_t node_count = 0;
+static size_t nodes_size = 0;
+
+static struct path_dir_t* dirs = NULL; // The $PATH the trie was built from
+static size_t dir_count = 0;
+static int built = 0;
+
+static uint32_t new_node(unsigned char c, uint32_t sibling) {
+	if (node_count == nodes_size) {
+		nodes_size = nodes_size ? nodes_size * 2 : 4096;
+		nodes = (struct trie_node_t*)realloc(nodes, sizeof(struct trie_node_t) * nodes_size);
+	}
+	nodes[node_count] = (struct trie_node_t){0, sibling, c, 0};
+	return node_count++;
+}
+
+static void insert(const char* name) {
+	uint32_t node = 0;
+	for (const unsigned char* p = (const unsigned char*)name; *p; p++) {
+		// Find where *p goes among the children, keeping them sorted
+		uint32_t prev = 0, child = nodes[node].child;
+		while (child && nodes[child].c < *p) {
+			prev = child;
+			child = nodes[child].sibling;
+		}
+		if (child == 0 || nodes[child].c != *p) {
+			child = new_node(*p, child);
+			if (prev) {
+				nodes[prev].sibling = child;
+			} else {
+				nodes[node].child = child;
+			}
+		}
+		node = child;
+	}
+	nodes[node].terminal = 1;
+}
+
+/**
+ * @return The node for the last character of prefix, 0 for the root
+ */
+static uint32_t find(const char* prefix, int* found) {
+	uint32_t node = 0;
+	*found = 1;
+	for (const unsigned char* p = (const unsigned char*)prefix; *p; p++) {
+		uint32_t child = nodes[node].child;
+		while (child && nodes[child].c < *p) {
+			child = nodes[child].sibling;
+		}
+		if (child == 0 || nodes[child].c != *p) {
+			*found = 0;
+			return 0;
+		}
+		node = child;
+	}
+	return node;
+}
+
+static void add_dir(const char* path, size_t len) {
+	struct path_dir_t* dir = &dirs[dir_count++];
+	dir->path = strndup(path, len);
+	dir->mtime = (struct timespec){0, 0};
+
+	int fd = open(dir->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		if (fd >= 0) {
+			close(fd);
+		}
+		return; // Doesn't exist (yet), the zero mtime notices if it appears
+	}
+	dir->mtime = st.st_mtim;
+	DIR* d = fdopendir(fd);
+	struct dirent* entry;
+	while ((entry = readdir(d)) != NULL) {
+		if (entry->d_name[0] == '.' || entry->d_type == DT_DIR) {
+			continue;
+		}
+		// Same test search_path in cmdhash.c uses to run it
+		if (fstatat(fd, entry->d_name, &st, 0) == 0 && S_ISREG(st.st_mode) &&
+		    faccessat(fd, entry->d_name, X_OK, 0) == 0) {
+			insert(entry->d_name);
+		}
+	}
+	closedir(d);
+}
+
+static void build() {
+	for (size_t i = 0; i < dir_count; i++) {
+		free(dirs[i].path);
+	}
+	node_count = 0;
+	dir_count = 0;
+	new_node(0, 0);
+
+	for (const struct builtin_t* builtin = builtins; builtin->name; builtin++) {
+		insert(builtin->name);
+	}
+	insert("time");
+
+	const char* path = var_get("PATH");
+	if (path == NULL) {
+		path = "/bin:/usr/bin"; // Same default as cmdhash.c
+	}
+	size_t count = 1;
+	for (const char* p = path; *p; p++) {
+		count += *p == ':';
+	}
+	dirs = (struct path_dir_t*)realloc(dirs, sizeof(struct path_dir_t) * count);
+	while (1) {
+		const char* end = strchrnul(path, ':');
+		if (end == path) {
+			add_dir(".", 1); // An empty entry means the current directory
+		} else {
+			add_dir(path, end - path);
+		}
+		if (*end == '\0') {
+			break;
+		}
+		path = end + 1;
+	}
+	built = 1;
+}
+
+/**
+ * @return Whether something was added to or removed from a $PATH directory
+ */
+static int dirs_changed() {
+	for (size_t i = 0; i < dir_count; i++) {
+		struct stat st;
+		struct timespec mtime = {0, 0};
+		if (stat(dirs[i].path, &st) == 0) {
+			mtime = st.st_mtim;
+		}
+		if (mtime.tv_sec != dirs[i].mtime.tv_sec || mtime.tv_nsec != dirs[i].mtime.tv_nsec) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Put every name under node in matches, in order
+ * @param name Buffer holding the name so far, len characters of it
+ */
+static void collect(uint32_t node, char* name, size_t len, char*** matches, size_t* count, size_t* size) {
+	if (nodes[node].terminal) {
+		if (*count + 3 > *size) { // Room for the prefix and the NULL
+			*size *= 2;
+			*matches = (char**)realloc(*matches, sizeof(char*) * *size);
+		}
+		(*matches)[++*count] = strndup(name, len);
+	}
+	for (uint32_t child = nodes[node].child; child; child = nodes[child].sibling) {
+		name[len] = nodes[child].c;
+		collect(child, name, len + 1, matches, count, size);
+	}
+}
+
+/**
+ * Find the builtins and commands in $PATH that start with prefix
+ * @return NULL if there are none, otherwise what a readline
+ *         rl_attempted_completion_function returns: the longest common
+ *         prefix, then the matches in order, then NULL. If there's only one
+ *         it's just the match and NULL. All of it is malloc'd.
+ */
+char** complete_command(const char* prefix) {
+	if (!built || dirs_changed()) {
+		build();
+	}
+
+	int found;
+	uint32_t node = find(prefix, &found);
+	if (!found) {
+		return NULL;
+	}
+
+	char name[NAME_MAX + 1];
+	size_t len = strlen(prefix);
+	if (len > NAME_MAX) {
+		return NULL; // Can't be a file name then
+	}
+	memcpy(name, prefix, len);
+
+	// Extend the prefix as far as every match agrees
+	size_t common = len;
+	uint32_t end = node;
+	while (!nodes[end].terminal && nodes[end].child && nodes[nodes[end].child].sibling == 0) {
+		end = nodes[end].child;
+		name[common++] = nodes[end].c;
+	}
+
+	size_t count = 0, size = 16;
+	char** matches = (char**)malloc(sizeof(char*) * size);
+	collect(end, name, common, &matches, &count, &size);
+	if (count == 1) {
+		matches[0] = matches[1];
+		matches[1] = NULL;
+	} else {
+		matches[0] = strndup(name, common);
+		matches[count + 1] = NULL;
+	}
+	return matches;
+}
+
+/**
+ * Build the trie again next time, e.g. because $PATH changed
+ */
+void complete_invalidate() {
+	built = 0;
+}
@@ -0,0 +1,11 @@
+/**
+ * @file complete.h
+ */
+
+#ifndef _COMPLETE_H
+#define _COMPLETE_H
+
+char** complete_command(const char* prefix);
+void complete_invalidate();
+
+#endif // _COMPLETE_H
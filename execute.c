@@ -0,0 +1,745 @@
+/**
+ * @file execute.c
+ *
+ * Running parsed commands: setting up pipelines and redirects, launching
+ * externals and running builtins.
+ */
+
+#define _GNU_SOURCE // pipe2 and F_SETPIPE_SZ
+#include "execute.h"
+#include "builtins.h"
+#include "cmdhash.h"
+#include "jobs.h"
+#include "stats.h"
+#include "trace.h"
+#include "zygote.h"
+#include "vars.h"
+#include "rlimits.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <errno.h>
+#include <limits.h>
+#include <spawn.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+
+pid_t pipeline_pgid;
+sigset_t sigmask;    // Signal mask children should start with
+int last_status;     // Exit status of the last command, like $?
+int builtin_status;  // Exit status a builtin asked for, or -1 to go by its return
+
+// Capacity for the pipes between stages from $PIPESIZE, 0 for the kernel's
+// default. Kept up to date by pipe_size_changed().
+static long pipe_size = 0;
+
+// Output pipe of a leftmost builtin that hasn't run yet. Builtins forked
+// for later stages have to close it, exec won't do it for them.
+static int deferred_builtin_fd = -1;
+
+/**
+ * @return The most an unprivileged process can make a pipe hold, or 0 if unknown
+ */
+static long pipe_max_size() {
+	long max = 0;
+	FILE* file = fopen("/proc/sys/fs/pipe-max-size", "r");
+	if (file) {
+		if (fscanf(file, "%ld", &max) != 1) {
+			max = 0;
+		}
+		fclose(file);
+	}
+	return max;
+}
+
+/**
+ * Work out how big $PIPESIZE wants pipes to be, complaining now if it's
+ * not a size rather than when the next pipeline is built. It's in bytes,
+ * with an optional k or m suffix, and gets capped at what the kernel allows.
+ */
+void pipe_size_changed() {
+	pipe_size = 0;
+
+	const char* val = var_get("PIPESIZE");
+	if (val == NULL || *val == '\0') {
+		return;
+	}
+	char* end;
+	errno = 0;
+	long size = strtol(val, &end, 10);
+	int shift = 0;
+	if (*end == 'k' || *end == 'K') {
+		shift = 10;
+		end++;
+	} else if (*end == 'm' || *end == 'M') {
+		shift = 20;
+		end++;
+	}
+	if (*end != '\0' || errno == ERANGE || size <= 0 || size > LONG_MAX >> shift) {
+		printf("PIPESIZE: %s is not a size\n", val);
+		return;
+	}
+	size <<= shift;
+
+	long max = pipe_max_size();
+	if (max > 0 && size > max) {
+		size = max;
+	}
+	if (size > INT_MAX) {
+		// Nothing to cap it with, and fcntl only takes an int
+		printf("PIPESIZE: %s is too big\n", val);
+		return;
+	}
+	pipe_size = size;
+}
+
+/**
+ * Create a pipe between two stages. Both ends are close-on-exec, children
+ * get the end they need dup'd onto stdin or stdout.
+ * @return 0 on success, -1 on failure
+ */
+static int make_pipe(int pipefd[2]) {
+	if (pipe2(pipefd, O_CLOEXEC) < 0) {
+		return -1;
+	}
+	if (pipe_size > 0 && fcntl(pipefd[1], F_SETPIPE_SZ, (int)pipe_size) < 0) {
+		// Still a working pipe, just a smaller one
+		perror("Failed to resize pipe");
+	}
+	return 0;
+}
+
+/**
+ * Run a builtin in the shell itself, and add it to the job so it has a
+ * status in $PIPESTATUS. If the pipeline is being timed, what the shell
+ * used while it ran goes in the job's report too.
+ */
+static status_t run_builtin(struct job_t* job, struct command_t* cmd, int fd[]) {
+	struct rusage before, usage;
+	memset(&usage, 0, sizeof(usage));
+	double start = now_seconds();
+	if (job->timed) {
+		getrusage(RUSAGE_SELF, &before);
+	}
+	status_t ret = execute_builtin(cmd, fd);
+	if (job->timed) {
+		getrusage(RUSAGE_SELF, &usage);
+
+		// Everything but the peak RSS counts up over the shell's whole life
+		timersub(&usage.ru_utime, &before.ru_utime, &usage.ru_utime);
+		timersub(&usage.ru_stime, &before.ru_stime, &usage.ru_stime);
+		usage.ru_nvcsw -= before.ru_nvcsw;
+		usage.ru_nivcsw -= before.ru_nivcsw;
+		usage.ru_minflt -= before.ru_minflt;
+		usage.ru_majflt -= before.ru_majflt;
+	}
+	int status = builtin_status >= 0 ? builtin_status : ret == BUILTIN_ERROR;
+	job_add_shell(job, cmd->argv[0], start, &usage, W_EXITCODE(status & 0xff, 0));
+	return ret;
+}
+
+status_t execute_command(struct command_t* cmd) {
+	status_t ret;
+	size_t child_count = 0;
+	int last_failed = 0; // Rightmost stage couldn't be launched
+	int background = cmd->background;
+
+	// A limit prefix forks a builtin, which would throw away whatever it
+	// did to the shell, so don't pretend to run it
+	for (struct command_t* stage = cmd; stage; stage = stage->pipe) {
+		if (stage->limits && stage->builtin && builtin_changes_shell(stage->builtin)) {
+			printf("limit: %s changes the shell, it can't run with limits\n", stage->argv[0]);
+			last_status = 1;
+			return BUILTIN_ERROR;
+		}
+	}
+
+	// Anything we printed has to come out before the children's output
+	fflush(stdout);
+
+	int fd[2] = {STDIN_FILENO, STDOUT_FILENO};
+	// A leftmost builtin runs in the shell itself, unless it's going into
+	// the background or has limits, in which case it gets forked like
+	// everything else
+	const struct builtin_t* builtin = background || cmd->limits ? NULL : cmd->builtin;
+	struct limits_t limits;
+
+	// Block SIGCHLD until the children are in the job table, so none of
+	// them can be reaped before we know they're ours
+	sigset_t mask, old_mask;
+	sigemptyset(&mask);
+	/*sigaddset(&mask, SIGINT);  // We want to block INT*/
+	sigaddset(&mask, SIGCHLD); // and CHLD
+	sigprocmask(SIG_BLOCK, &mask, &old_mask);
+
+	struct job_t* job = job_new(cmd, background);
+	pipeline_pgid = 0;
+
+	if (cmd->pipe) {
+		ret = PIPE_OK;
+		// We have a pipeline, need to set up all the pipage
+		int pipefd[2];
+		struct command_t* first = cmd;
+		int builtin_out = -1; // Write end of a leftmost builtin's pipe
+
+		while (cmd) {
+			if (child_count > 0) {
+				// We have somewhere to pipe from
+				if (fd[0] >= 0 && fd[0] != STDIN_FILENO) {
+					if (close(fd[0]) < 0) {
+						perror("Failed to close input pipe");
+						ret = PIPE_ERROR;
+						break;
+					}
+				}
+				fd[0] = pipefd[0];
+			} else {
+				fd[0] = STDIN_FILENO;
+			}
+
+			if (cmd->pipe) {
+				// We have somewhere to pipe to
+
+				if (make_pipe(pipefd) < 0) {
+					perror("Failed to create pipe");
+					ret = PIPE_ERROR;
+					break;
+				}
+
+				fd[1] = pipefd[1];
+
+				if (child_count == 0) {
+					// We want the child to close this, and not use it, so set it to negative
+					// so set it to negative to signify this
+					fd[0] = -pipefd[0];
+				}
+			} else {
+				fd[1] = STDOUT_FILENO;
+			}
+
+			if (child_count > 0 || !builtin) {
+				// We're either not builtin, or not leftmost
+				// so we want to execute it as a child
+				pid_t pid = execute_command_child(cmd, fd, pipeline_pgid);
+				if (pid < 0) {
+					// Already complained, the rest of the pipeline just sees no input
+					last_failed = !cmd->pipe;
+					job_add_failed(job, cmd->argv[0]);
+				} else {
+					if (pipeline_pgid == 0) {
+						pipeline_pgid = pid;
+					}
+					// EACCES means it already exec'd, which it only does after joining the group.
+					// ESRCH means the zygote launched it, and it joins the group itself.
+					if (setpgid(pid, pipeline_pgid) < 0 && errno != EACCES && errno != ESRCH) {
+						perror("Failed to set process group");
+					}
+					job_add(job, pid, cmd->argv[0], execute_limits(cmd, &limits));
+				}
+			} else {
+				// We're a builtin and leftmost. Nothing would be reading
+				// yet if we ran now, so more than a pipe's worth of output
+				// would block forever. Run once the rest are going instead.
+				builtin_out = pipefd[1];
+				deferred_builtin_fd = builtin_out;
+			}
+			child_count++;
+
+			if (fd[1] != STDOUT_FILENO && fd[1] != builtin_out) {
+				if (close(pipefd[1]) < 0) {
+					perror("Failed to close output pipe");
+					ret = PIPE_ERROR;
+				}
+			}
+
+			cmd = cmd->pipe;
+		}
+
+		if (child_count > 0) {
+			if (close(pipefd[0]) < 0) {
+				perror("Failed to close input pipe");
+				ret = PIPE_ERROR;
+			}
+		}
+
+		// Everything that will join the group has, the zygote can reap again
+		zygote_release();
+
+		if (builtin_out >= 0) {
+			if (ret != PIPE_ERROR) {
+				// If the reader quits early we want EPIPE, not to be killed
+				void (*old_handler)(int) = signal(SIGPIPE, SIG_IGN);
+				int out_fd[2] = {STDIN_FILENO, builtin_out};
+				run_builtin(job, first, out_fd);
+				signal(SIGPIPE, old_handler);
+			}
+			// Closing it is what tells the reader we're done
+			deferred_builtin_fd = -1;
+			if (close(builtin_out) < 0) {
+				perror("Failed to close output pipe");
+				ret = PIPE_ERROR;
+			}
+		}
+
+	} else {
+		// No pipeline, we can just run the command regularly
+		if (!builtin) {
+			pid_t pid = execute_command_child(cmd, fd, 0);
+			if (pid < 0) {
+				last_failed = 1;
+				job_add_failed(job, cmd->argv[0]);
+				ret = EXTERNAL_ERROR;
+			} else {
+				pipeline_pgid = pid;
+				if (setpgid(pipeline_pgid, pipeline_pgid) < 0 && errno != EACCES && errno != ESRCH) {
+					perror("Failed to set process group");
+				}
+				job_add(job, pid, cmd->argv[0], execute_limits(cmd, &limits));
+				ret = EXTERNAL_OK;
+			}
+			zygote_release();
+		} else {
+			ret = run_builtin(job, cmd, fd);
+			if (ret != BUILTIN_EXIT) { // exit keeps the previous status, like sh
+				last_status = builtin_status >= 0 ? builtin_status : ret == BUILTIN_ERROR;
+			}
+		}
+	}
+	job->pgid = pipeline_pgid;
+	if (pipeline_pgid) {
+		trace_process_name(pipeline_pgid, job->text);
+	}
+
+	if (job->proc_count > 0 && ret == PIPE_ERROR) {
+		// Murder the children
+		/*printf("Murdering the children %d (%ld of them)\n", pipeline_pgid, child_count);*/
+		if (pipeline_pgid && killpg(pipeline_pgid, SIGINT) < 0) {
+			perror("Failed to murder the children");
+		}
+	}
+
+	if (pipeline_pgid == 0) {
+		// Nothing was launched, it was a builtin or nothing could start
+		if (job->timed && job->proc_count > 0) {
+			job_report(job);
+		}
+		if (last_failed) {
+			last_status = 127;
+		}
+		if (ret != BUILTIN_EXIT) {
+			job_set_pipestatus(job);
+		}
+		job_free(job);
+	} else if (background) {
+		job_started(job);
+		last_status = 0;
+	} else {
+		STATS_START(wait_start);
+		int status = job_wait(job, 1);
+		STATS_STOP(kStatWait, wait_start);
+		last_status = last_failed ? 127 : status;
+	}
+
+	pipeline_pgid = 0;
+
+	// Done with the pipeline, restore signal mask
+	sigprocmask(SIG_SETMASK, &old_mask, NULL);
+	return ret;
+}
+
+/**
+ * The limits a command runs with, its limit prefix over the shell's defaults
+ * @param merged Where to put them
+ * @return merged, or NULL if there aren't any
+ */
+const struct limits_t* execute_limits(const struct command_t* cmd, struct limits_t* merged) {
+	if (!limits_default.set && !cmd->limits) {
+		return NULL;
+	}
+	*merged = limits_default;
+	if (cmd->limits) {
+		limits_merge(merged, cmd->limits);
+	}
+	return merged;
+}
+
+/**
+ * Replace a forked child with an external command. Its pipes are already
+ * on stdin and stdout, so all that's left is its redirects.
+ * @param path Where cmdhash_lookup found it
+ */
+static void exec_external(struct command_t* cmd, const char* path) {
+	if (cmd->in_file) {
+		int in_fd = open(cmd->in_file, O_RDONLY);
+		if (in_fd < 0 || dup2(in_fd, STDIN_FILENO) < 0) {
+			perror("external: Failed to open input file");
+			_exit(1);
+		}
+		close(in_fd);
+	}
+	if (cmd->out_file) {
+		int out_fd = open(cmd->out_file, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+		if (out_fd < 0 || dup2(out_fd, STDOUT_FILENO) < 0) {
+			perror("external: Failed to open output file");
+			_exit(1);
+		}
+		close(out_fd);
+	}
+	execve(path, cmd->argv, vars_environ());
+	if (errno == ENOEXEC) {
+		execve("/bin/sh", sh_fallback_argv(path, cmd->argv), vars_environ());
+	}
+	perror(cmd->argv[0]);
+	_exit(errno == ENOENT ? 127 : 126);
+}
+
+status_t execute_command_child(struct command_t* cmd, int pipefd[], pid_t pgid) {
+	struct limits_t merged;
+	const struct limits_t* limits = execute_limits(cmd, &merged);
+	const char* path = NULL;
+	if (!cmd->builtin && limits) {
+		// Limits have to be set in the child, which posix_spawn can't do,
+		// so it gets forked like a builtin. Look it up first so not finding
+		// it is dealt with the same way either way.
+		if ((path = cmdhash_lookup(cmd->argv[0])) == NULL) {
+			errno = ENOENT;
+			perror(cmd->argv[0]);
+			return -1;
+		}
+	} else if (!cmd->builtin) {
+		// Externals don't need a copy of the shell, so skip the fork
+		double trace_start = trace_enabled ? now_seconds() : 0;
+		STATS_START(start);
+		pid_t pid = execute_external(cmd, pipefd, pgid);
+		STATS_STOP(kStatLaunch, start);
+		if (trace_enabled && pid > 0) {
+			trace_span("spawn", "launch", trace_start, now_seconds(), pgid ? pgid : pid, pid, NULL);
+		}
+		return pid;
+	}
+
+	double trace_start = trace_enabled ? now_seconds() : 0;
+	STATS_START(start);
+	pid_t pid = 0;
+	if ((pid = fork()) < 0) {
+		close(pipefd[0]);
+		close(pipefd[1]);
+		perror("Error forking");
+	} else if (pid == 0) {
+		// Child
+		// Delete signal handlers
+		if (signal(SIGINT, SIG_DFL) == SIG_ERR ||
+			signal(SIGTSTP, SIG_DFL) == SIG_ERR ||
+			signal(SIGTTIN, SIG_DFL) == SIG_ERR ||
+			signal(SIGTTOU, SIG_DFL) == SIG_ERR) {
+			perror("Failed to delete signal handler");
+		}
+
+		// Unblock signals
+		sigprocmask(SIG_SETMASK, &sigmask, NULL);
+
+		if (deferred_builtin_fd >= 0) {
+			close(deferred_builtin_fd);
+		}
+
+		// Join the pipeline's group, or start it. The parent does this too,
+		// but once we exec it can't, so it has to be done by then.
+		if (setpgid(0, pgid) < 0) {
+			perror("child: Failed to set process group");
+		}
+
+		if (pipefd[0] != STDIN_FILENO) {
+			if (pipefd[0] >= 0) {
+				if (dup2(pipefd[0], STDIN_FILENO) < 0) {
+					perror("Failed to redirect stdin");
+				}
+			} else {
+				pipefd[0] = -pipefd[0];
+			}
+			if (close(pipefd[0]) < 0) {
+				perror("Failed to close input pipe");
+			}
+		}
+
+		if (pipefd[1] != STDOUT_FILENO) {
+			if (pipefd[1] >= 0) {
+				if (dup2(pipefd[1], STDOUT_FILENO) < 0) {
+					perror("Failed to redirect stdout");
+				}
+			} else {
+				pipefd[1] = -pipefd[1];
+			}
+			if (close(pipefd[1]) < 0) {
+				perror("Failed to close output pipe");
+			}
+		}
+
+		if (limits && limits_apply(limits) < 0) {
+			_exit(126); // Not running it with fewer limits than asked for
+		}
+		if (path) {
+			exec_external(cmd, path);
+		}
+
+		int fd[2] = {STDIN_FILENO, STDOUT_FILENO};
+		status_t ret = execute_builtin(cmd, fd);
+		// _exit, because exit would also rewind a script we're reading to
+		// where our copy of its FILE got to, and the shell would read it again
+		fflush(stdout);
+		if (ret == BUILTIN_EXIT) {
+			// Well, we're in a fork, so this will just
+			// kill the fork.
+			close(STDIN_FILENO);
+			_exit(127);
+		}
+		_exit(builtin_status >= 0 ? builtin_status : ret == BUILTIN_ERROR);
+	}
+	STATS_STOP(kStatLaunch, start);
+	if (trace_enabled && pid > 0) {
+		trace_span("fork", "launch", trace_start, now_seconds(), pgid ? pgid : pid, pid, NULL);
+	}
+	return pid;
+}
+
+status_t execute_builtin(struct command_t* cmd, int pipefd[]) {
+	status_t ret = BUILTIN_MISSING;
+	if (!cmd->builtin) {
+		return BUILTIN_MISSING;
+	}
+
+	// Builtin found
+	ret = BUILTIN_OK;
+
+	int stdout_dup, stdin_dup, out_fd, in_fd;
+	stdout_dup = stdin_dup = out_fd = in_fd = -1;
+
+	// Setup redirects if they exist
+
+	if (cmd->in_file || (pipefd[0] >= 0 && pipefd[1] != STDIN_FILENO)) {
+		// We're redirecting stdin somewhere, so save the old one
+		if ((stdin_dup = dup(STDIN_FILENO)) < 0) {
+			perror("builtin: Failed to store stdin fd");
+			ret = BUILTIN_ERROR;
+		}
+	}
+	if (cmd->in_file) { // We're redirecting to a file
+		if ((in_fd = open(cmd->in_file, O_RDONLY)) < 0) {
+			perror("builtin: Failed to open input file");
+			ret = BUILTIN_ERROR;
+		}
+	} else if (pipefd[0] != STDIN_FILENO) { // We're rediricting to a pipe
+		in_fd = pipefd[0];
+	}
+	if (in_fd >= 0 && dup2(in_fd, STDIN_FILENO) < 0) { // Do the redirection
+		perror("builtin: Failed to redirect stdin");
+		ret = BUILTIN_ERROR;
+	}
+
+	if (ret == BUILTIN_OK) {
+	if (cmd->out_file || (pipefd[1] >= 0 && pipefd[1] != STDOUT_FILENO)) {
+		// We're redirecting stdout somewhere, so save the old one
+		if ((stdout_dup = dup(STDOUT_FILENO)) < 0) {
+			perror("builtin: Failed to store stdout fd");
+			ret = BUILTIN_ERROR;
+		}
+	}
+	if (cmd->out_file) { // We're redirecting to a file
+		if ((out_fd = open(cmd->out_file, O_WRONLY|O_CREAT|O_TRUNC, 0666)) < 0) {
+			perror("builtin: Failed to open output file");
+			ret = BUILTIN_ERROR;
+		}
+	} else if (pipefd[1] != STDOUT_FILENO) { // We're rediricting to a pipe
+		out_fd = pipefd[1];
+	}
+	if (out_fd >= 0 && dup2(out_fd, STDOUT_FILENO) < 0) { // Do the redirection
+		perror("builtin: Failed to redirect stdout");
+		ret = BUILTIN_ERROR;
+	}
+	}
+
+	// Execute the builtin
+	builtin_status = -1;
+	if (ret == BUILTIN_OK) {
+		double trace_start = trace_enabled ? now_seconds() : 0;
+		ret = (*(cmd->builtin->func))(cmd);
+		if (trace_enabled) {
+			trace_span(cmd->argv[0], "builtin", trace_start, now_seconds(), getpid(), getpid(), NULL);
+		}
+	}
+	// Its output has to reach the redirect before we put stdout back
+	fflush(stdout);
+
+	// Reset stdout and stdin back to what they were
+	if (cmd->out_file) {
+		if (out_fd >= 0 && close(out_fd) < 0) {
+			perror("builtin: Failed to close output file");
+			ret = BUILTIN_ERROR;
+		}
+	}
+	if (stdout_dup >= 0) {
+		// Reset stdout
+		if (dup2(stdout_dup, STDOUT_FILENO) < 0) {
+			perror("builtin: Failed to reset stdout");
+			ret = BUILTIN_ERROR;
+		}
+		if (close(stdout_dup) < 0) {
+			// There's literally nothing we can do here... it's kind of pointless
+			// to actually check if it's successful or not. If it's not, there's
+			// something seriously wrong.
+			perror("builtin: Failed to close stored stdout fd");
+			ret = BUILTIN_ERROR;
+		}
+	}
+	if (cmd->in_file) {
+		if (in_fd >= 0 && close(in_fd) < 0) {
+			perror("builtin: Failed to close input file");
+			ret = BUILTIN_ERROR;
+		}
+	}
+	if (stdin_dup >= 0) {
+		// Reset stdin
+		if (dup2(stdin_dup, STDIN_FILENO) < 0) {
+			perror("builtin: Failed to reset stdin");
+			ret = BUILTIN_ERROR;
+		}
+		if (close(stdin_dup) < 0) {
+			perror("builtin: Failed to close stored stdin fd");
+			ret = BUILTIN_ERROR;
+		}
+	}
+	return ret;
+}
+
+/**
+ * Launch an external command with posix_spawn. glibc implements it with
+ * clone(CLONE_VM|CLONE_VFORK), so unlike fork it doesn't have to copy the
+ * shell's page tables and costs the same however big our heap gets.
+ * @param cmd Command to run
+ * @param pipefd Input and output fds, negative ones are closed rather than used
+ * @param pgid Process group to join, or 0 to start a new one
+ * @return The child's pid, or -1 if it couldn't be started
+ */
+status_t execute_external(struct command_t* cmd, int pipefd[], pid_t pgid) {
+	const char* path = cmdhash_lookup(cmd->argv[0]);
+	if (path == NULL) {
+		errno = ENOENT;
+		perror(cmd->argv[0]);
+		return -1;
+	}
+
+	// Open redirects here rather than as file actions so we can tell the
+	// user which part failed. O_CLOEXEC keeps them out of other children.
+	int out_fd, in_fd;
+	out_fd = in_fd = -1;
+	if (cmd->out_file) {
+		if ((out_fd = open(cmd->out_file, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0666)) < 0) {
+			perror("external: Failed to open output file");
+			return -1;
+		}
+	}
+	if (cmd->in_file) {
+		if ((in_fd = open(cmd->in_file, O_RDONLY|O_CLOEXEC)) < 0) {
+			perror("external: Failed to open input file");
+			if (out_fd >= 0) {
+				close(out_fd);
+			}
+			return -1;
+		}
+	}
+
+	if (zygote_active()) {
+		// What the child's stdin and stdout end up as, files win over pipes
+		int child_in = in_fd >= 0 ? in_fd : pipefd[0] >= 0 ? pipefd[0] : STDIN_FILENO;
+		int child_out = out_fd >= 0 ? out_fd : pipefd[1] >= 0 ? pipefd[1] : STDOUT_FILENO;
+		pid_t pid = zygote_spawn(path, cmd->argv, vars_environ(), currentDir(), child_in, child_out, pgid);
+		if (pid >= 0 || errno != EAGAIN) {
+			int err = errno;
+			if (out_fd >= 0) {
+				close(out_fd);
+			}
+			if (in_fd >= 0) {
+				close(in_fd);
+			}
+			if (pid < 0) {
+				errno = err;
+				perror(cmd->argv[0]);
+			}
+			return pid;
+		}
+		// It couldn't take this one, launch it ourselves
+	}
+
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+
+	if (pipefd[0] != STDIN_FILENO) {
+		if (pipefd[0] >= 0) {
+			posix_spawn_file_actions_adddup2(&actions, pipefd[0], STDIN_FILENO);
+			posix_spawn_file_actions_addclose(&actions, pipefd[0]);
+		} else {
+			posix_spawn_file_actions_addclose(&actions, -pipefd[0]);
+		}
+	}
+	if (pipefd[1] != STDOUT_FILENO) {
+		if (pipefd[1] >= 0) {
+			posix_spawn_file_actions_adddup2(&actions, pipefd[1], STDOUT_FILENO);
+			posix_spawn_file_actions_addclose(&actions, pipefd[1]);
+		} else {
+			posix_spawn_file_actions_addclose(&actions, -pipefd[1]);
+		}
+	}
+	// Files win over pipes, same as when we dup2'd them by hand
+	if (out_fd >= 0) {
+		posix_spawn_file_actions_adddup2(&actions, out_fd, STDOUT_FILENO);
+	}
+	if (in_fd >= 0) {
+		posix_spawn_file_actions_adddup2(&actions, in_fd, STDIN_FILENO);
+	}
+
+	posix_spawnattr_t attr;
+	posix_spawnattr_init(&attr);
+
+	// Put back the job control signals we ignore and the mask we had before
+	// blocking SIGCHLD for the pipeline
+	sigset_t defaults;
+	sigemptyset(&defaults);
+	sigaddset(&defaults, SIGINT);
+	sigaddset(&defaults, SIGTSTP);
+	sigaddset(&defaults, SIGTTIN);
+	sigaddset(&defaults, SIGTTOU);
+	posix_spawnattr_setsigdefault(&attr, &defaults);
+	posix_spawnattr_setsigmask(&attr, &sigmask);
+	posix_spawnattr_setpgroup(&attr, pgid);
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK);
+
+	pid_t pid;
+	int err = posix_spawn(&pid, path, &actions, &attr, cmd->argv, vars_environ());
+	if (err == ENOEXEC) {
+		char** sh_argv = sh_fallback_argv(path, cmd->argv);
+		err = posix_spawn(&pid, "/bin/sh", &actions, &attr, sh_argv, vars_environ());
+		free(sh_argv);
+	}
+
+	posix_spawnattr_destroy(&attr);
+	posix_spawn_file_actions_destroy(&actions);
+
+	if (out_fd >= 0 && close(out_fd) < 0) {
+		perror("external: Failed to close output file");
+	}
+	if (in_fd >= 0 && close(in_fd) < 0) {
+		perror("external: Failed to close input file");
+	}
+
+	if (err != 0) {
+		errno = err;
+		perror(cmd->argv[0]);
+		return -1;
+	}
+	return pid;
+}
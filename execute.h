@@ -0,0 +1,26 @@
+/**
+ * @file execute.h
+ */
+
+#ifndef _EXECUTE_H
+#define _EXECUTE_H
+
+#include "parser.h"
+#include "utility.h"
+#include "rlimits.h"
+#include <sys/types.h>
+#include <signal.h>
+
+extern pid_t pipeline_pgid;
+extern sigset_t sigmask;
+extern int last_status;
+extern int builtin_status;
+
+void pipe_size_changed();
+status_t execute_command(struct command_t* cmd);
+status_t execute_command_child(struct command_t* cmd, int pipefd[], pid_t pgid);
+status_t execute_builtin(struct command_t* cmd, int pipefd[]);
+status_t execute_external(struct command_t* cmd, int pipefd[], pid_t pgid);
+const struct limits_t* execute_limits(const struct command_t* cmd, struct limits_t* merged);
+
+#endif // _EXECUTE_H
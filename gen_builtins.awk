@@ -0,0 +1,54 @@
+# Generates builtins_lookup.h from builtins.def: a switch on the name's
+# length and then its first character, so finding a builtin costs at most
+# a couple of memcmps no matter how many there are.
+
+/^BUILTIN\(/ {
+	name = $0
+	sub(/^BUILTIN\([ \t]*/, "", name)
+	sub(/[ \t]*,.*$/, "", name)
+	len = length(name)
+	first = substr(name, 1, 1)
+	if (!(len in lens)) {
+		lens[len] = 1
+		len_order[++len_count] = len
+	}
+	key = len SUBSEP first
+	if (!(key in firsts)) {
+		firsts[key] = 1
+		first_order[len, ++first_count[len]] = first
+	}
+	names[key, ++name_count[key]] = name
+	index_of[name] = count++
+}
+
+END {
+	print "// Generated from builtins.def by gen_builtins.awk, do not edit"
+	print ""
+	print "/**"
+	print " * Find a builtin by name"
+	print " * @param name Name to look up"
+	print " * @return Index into builtins[], or -1 if it isn't a builtin"
+	print " */"
+	print "static int lookup_builtin(const char* name) {"
+	print "\tswitch (strlen(name)) {"
+	for (i = 1; i <= len_count; i++) {
+		len = len_order[i]
+		printf "\tcase %d:\n", len
+		print "\t\tswitch (name[0]) {"
+		for (j = 1; j <= first_count[len]; j++) {
+			first = first_order[len, j]
+			key = len SUBSEP first
+			printf "\t\tcase '%s':\n", first
+			for (k = 1; k <= name_count[key]; k++) {
+				name = names[key, k]
+				printf "\t\t\tif (memcmp(name, \"%s\", %d) == 0) return %d;\n", name, len, index_of[name]
+			}
+			print "\t\t\tbreak;"
+		}
+		print "\t\t}"
+		print "\t\tbreak;"
+	}
+	print "\t}"
+	print "\treturn -1;"
+	print "}"
+}
@@ -0,0 +1,478 @@
+/**
+ * @file histdb.c
+ *
+ * Command history that outlives the shell. The file is an append-only log
+ * of one command per line, so several shells can add to it at once. At
+ * startup it's memory-mapped and walked back from the end only as far as
+ * the newest cap distinct commands, which are used where they sit in the
+ * mapping instead of being copied. Older lines and duplicates are dropped
+ * from the file when they make up more than half of it. That happens with
+ * the file locked, and a shell that finds the file has been replaced under
+ * it reopens it before adding anything.
+ *
+ * Repeating a command moves it to the end rather than adding it again.
+ * Searching goes through a trigram index: the query's rarest trigram gives
+ * the few entries worth checking, newest first, so finding something in a
+ * million entries doesn't mean looking at all of them.
+ */
+
+#define _GNU_SOURCE // memrchr, memmem
+#include "histdb.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/file.h>
+
+#define HISTDB_BUCKETS (1 << 16)
+#define HISTDB_MIN_REBUILD 1024
+
+struct histdb_entry_t {
+	const char* line; // Not NUL terminated, it might be in the mapping
+	uint32_t len;
+	uint32_t hash;
+	uint8_t alive;    // Cleared when it's repeated later or falls off the end
+	uint8_t owned;    // Malloc'd, rather than in the mapping
+};
+
+struct posting_list_t {
+	uint32_t* ids; // Ascending entry indexes that have a trigram in this bucket
+	uint32_t count;
+	uint32_t size;
+};
+
+static struct histdb_entry_t* entries = NULL; // Oldest first
+static size_t entry_count = 0;
+static size_t entries_size = 0;
+static size_t alive_count = 0;
+static size_t oldest = 0; // No live entries before this
+static size_t cap = HISTDB_DEFAULT_SIZE;
+
+// One slot for each distinct line. The hash is kept here so most probes
+// don't have to go and look at the line.
+struct dedup_slot_t {
+	uint32_t hash;
+	uint32_t id; // Entry index + 1, 0 for an empty slot
+};
+
+static struct dedup_slot_t* dedup = NULL;
+static size_t dedup_size = 0; // Power of two
+static size_t dedup_used = 0;
+
+static struct posting_list_t postings[HISTDB_BUCKETS];
+
+static int append_fd = -1;
+static char* history_path = NULL;
+
+static uint32_t hash_line(const char* line, size_t len) {
+	uint32_t h = 2166136261u;
+	for (size_t i = 0; i < len; i++) {
+		h = (h ^ (unsigned char)line[i]) * 16777619u;
+	}
+	return h;
+}
+
+static unsigned int trigram_bucket(const char* p) {
+	uint32_t t = (unsigned char)p[0] | (unsigned char)p[1] << 8 | (unsigned char)p[2] << 16;
+	return (t * 2654435761u) >> 16;
+}
+
+/**
+ * @return The slot holding the line, or the empty slot it would go in
+ */
+static struct dedup_slot_t* dedup_slot(const char* line, size_t len, uint32_t hash) {
+	size_t mask = dedup_size - 1;
+	for (size_t i = hash & mask;; i = (i + 1) & mask) {
+		if (dedup[i].id == 0) {
+			return &dedup[i];
+		}
+		if (dedup[i].hash != hash) {
+			continue;
+		}
+		const struct histdb_entry_t* entry = &entries[dedup[i].id - 1];
+		if (entry->len == len && memcmp(entry->line, line, len) == 0) {
+			return &dedup[i];
+		}
+	}
+}
+
+/**
+ * Size the dedup table for count lines and put the first count entries in
+ * it, which have to be distinct
+ */
+static void dedup_fill(size_t count) {
+	free(dedup);
+	dedup_size = 1024;
+	while (dedup_size < count * 2 + 64) {
+		dedup_size *= 2;
+	}
+	dedup = (struct dedup_slot_t*)calloc(dedup_size, sizeof(struct dedup_slot_t));
+	dedup_used = 0;
+	size_t mask = dedup_size - 1;
+	for (size_t id = 0; id < entry_count && dedup_used < count; id++) {
+		size_t i = entries[id].hash & mask;
+		while (dedup[i].id) {
+			i = (i + 1) & mask;
+		}
+		dedup[i] = (struct dedup_slot_t){entries[id].hash, id + 1};
+		dedup_used++;
+	}
+}
+
+static void index_entry(uint32_t id) {
+	const struct histdb_entry_t* entry = &entries[id];
+	for (uint32_t i = 0; i + 3 <= entry->len; i++) {
+		struct posting_list_t* list = &postings[trigram_bucket(entry->line + i)];
+		if (list->count && list->ids[list->count - 1] == id) {
+			continue; // Same trigram (or bucket) twice in one line
+		}
+		if (list->count == list->size) {
+			list->size = list->size ? list->size * 2 : 8;
+			list->ids = (uint32_t*)realloc(list->ids, sizeof(uint32_t) * list->size);
+		}
+		list->ids[list->count++] = id;
+	}
+}
+
+/**
+ * Squeeze out dead entries, then build the dedup table and index again
+ */
+static void rebuild() {
+	size_t n = 0;
+	for (size_t i = 0; i < entry_count; i++) {
+		if (entries[i].alive) {
+			entries[n++] = entries[i];
+		} else if (entries[i].owned) {
+			free((char*)entries[i].line);
+		}
+	}
+	entry_count = alive_count = n;
+	oldest = 0;
+
+	dedup_fill(entry_count);
+	for (int b = 0; b < HISTDB_BUCKETS; b++) {
+		postings[b].count = 0;
+	}
+	for (size_t i = 0; i < entry_count; i++) {
+		index_entry(i);
+	}
+}
+
+static void kill_entry(size_t i) {
+	entries[i].alive = 0;
+	alive_count--;
+}
+
+/**
+ * Drop the oldest entries until we're within the cap, and tidy up once
+ * more than half of what we hold is dead
+ */
+static void enforce_cap() {
+	while (alive_count > cap) {
+		while (!entries[oldest].alive) {
+			oldest++;
+		}
+		kill_entry(oldest);
+	}
+	if (entry_count > HISTDB_MIN_REBUILD && entry_count > alive_count * 2) {
+		rebuild();
+	}
+}
+
+static void add_entry(const char* line, size_t len, int owned) {
+	if (dedup_used * 2 >= dedup_size) {
+		rebuild();
+	}
+	uint32_t hash = hash_line(line, len);
+	struct dedup_slot_t* slot = dedup_slot(line, len, hash);
+	if (slot->id == 0) {
+		dedup_used++;
+	} else if (entries[slot->id - 1].alive) {
+		kill_entry(slot->id - 1);
+	}
+
+	if (entry_count == entries_size) {
+		entries_size = entries_size ? entries_size * 2 : 1024;
+		entries = (struct histdb_entry_t*)realloc(entries, sizeof(struct histdb_entry_t) * entries_size);
+	}
+	struct histdb_entry_t* entry = &entries[entry_count];
+	entry->line = line;
+	entry->len = len;
+	entry->hash = hash;
+	entry->alive = 1;
+	entry->owned = owned;
+	*slot = (struct dedup_slot_t){hash, entry_count + 1};
+	index_entry(entry_count);
+	entry_count++;
+	alive_count++;
+	enforce_cap();
+}
+
+/**
+ * Lock the history file, first reopening it if a compaction has replaced
+ * it since it was opened
+ * @param fd Open history file, updated if it has to be reopened
+ * @param path Where the history file is now
+ * @param flags How to reopen it
+ * @param operation LOCK_SH to add to it, LOCK_EX to read and replace it
+ * @return 0 once it's locked, -1 if it couldn't be reopened
+ */
+static int lock_current(int* fd, const char* path, int flags, int operation) {
+	while (1) {
+		if (flock(*fd, operation) < 0) {
+			return 0; // No locking here, carry on without it
+		}
+		struct stat ours, now;
+		if (fstat(*fd, &ours) == 0 && stat(path, &now) == 0 && ours.st_ino == now.st_ino && ours.st_dev == now.st_dev) {
+			return 0;
+		}
+		close(*fd);
+		if ((*fd = open(path, flags | O_CLOEXEC, 0600)) < 0) {
+			return -1;
+		}
+	}
+}
+
+/**
+ * Replace the file with just the entries we kept. The caller holds the
+ * lock, so nobody can add to the old file after we've read it.
+ */
+static void compact(const char* path) {
+	size_t path_len = strlen(path);
+	char* tmp = (char*)malloc(path_len + 5);
+	memcpy(tmp, path, path_len);
+	strcpy(tmp + path_len, ".new");
+	FILE* file = fopen(tmp, "w");
+	if (file == NULL) {
+		free(tmp);
+		return; // Not a problem, it just stays big
+	}
+	for (size_t i = 0; i < entry_count; i++) {
+		if (entries[i].alive) {
+			fwrite(entries[i].line, 1, entries[i].len, file);
+			fputc('\n', file);
+		}
+	}
+	if (fclose(file) != 0 || rename(tmp, path) < 0) {
+		perror("history: Failed to compact history file");
+		unlink(tmp);
+	}
+	free(tmp);
+}
+
+/**
+ * Load the history file and keep adding to it
+ * @param path History file, created if it doesn't exist
+ * @param max Most entries to keep
+ * @return 0 on success, -1 if history won't be saved
+ */
+int histdb_open(const char* path, size_t max) {
+	cap = max ? max : 1;
+	free(history_path);
+	history_path = strdup(path);
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd >= 0) {
+		// Held until we're done reading, and replacing if it comes to that
+		lock_current(&fd, path, O_RDONLY, LOCK_EX);
+	}
+	struct stat st;
+	if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size > 0) {
+		// The mapping stays for the life of the shell, entries point into it
+		const char* map = (const char*)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map != MAP_FAILED) {
+			// Newest first, skipping repeats, until we have enough
+			const char* end = map + st.st_size;
+			if (end[-1] == '\n') {
+				end--;
+			}
+			size_t kept_bytes = 0;
+			dedup_fill(0);
+			while (end > map && alive_count < cap) {
+				const char* start = (const char*)memrchr(map, '\n', end - map);
+				start = start ? start + 1 : map;
+				size_t len = end - start;
+				end = start > map ? start - 1 : map;
+				if (len == 0) {
+					continue;
+				}
+				if (dedup_used * 2 >= dedup_size) {
+					dedup_fill(dedup_used * 2);
+				}
+				uint32_t hash = hash_line(start, len);
+				struct dedup_slot_t* slot = dedup_slot(start, len, hash);
+				if (slot->id) {
+					continue;
+				}
+				if (entry_count == entries_size) {
+					entries_size = entries_size ? entries_size * 2 : 1024;
+					entries = (struct histdb_entry_t*)realloc(entries, sizeof(struct histdb_entry_t) * entries_size);
+				}
+				entries[entry_count] = (struct histdb_entry_t){start, len, hash, 1, 0};
+				*slot = (struct dedup_slot_t){hash, ++entry_count};
+				dedup_used++;
+				alive_count++;
+				kept_bytes += len + 1;
+			}
+			// Back to oldest first
+			for (size_t i = 0; i < entry_count / 2; i++) {
+				struct histdb_entry_t tmp = entries[i];
+				entries[i] = entries[entry_count - 1 - i];
+				entries[entry_count - 1 - i] = tmp;
+			}
+			rebuild();
+			if ((size_t)st.st_size > kept_bytes * 2) {
+				compact(path);
+			}
+		}
+	}
+	if (fd >= 0) {
+		// The mapping keeps the file open, so closing wouldn't unlock it
+		flock(fd, LOCK_UN);
+		close(fd);
+	}
+	if (dedup == NULL) {
+		rebuild();
+	}
+
+	if ((append_fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600)) < 0) {
+		perror("history: Failed to open history file");
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Change how many entries are kept, dropping the oldest if there are more
+ */
+void histdb_set_cap(size_t max) {
+	cap = max ? max : 1;
+	if (entries) {
+		enforce_cap();
+	}
+}
+
+/**
+ * Add a command, moving it to the end if it's already there
+ */
+void histdb_add(const char* line) {
+	size_t len = strlen(line);
+	if (len == 0) {
+		return;
+	}
+	if (dedup == NULL) {
+		rebuild(); // Never opened, keep it in memory only
+	}
+	char* copy = (char*)malloc(len);
+	memcpy(copy, line, len);
+	add_entry(copy, len, 1);
+
+	if (append_fd >= 0 && lock_current(&append_fd, history_path, O_WRONLY | O_APPEND | O_CREAT, LOCK_SH) < 0) {
+		perror("history: Failed to reopen history file");
+	}
+	if (append_fd >= 0) {
+		// One write, so lines from other shells can't get mixed into it
+		struct iovec iov[2] = {{copy, len}, {"\n", 1}};
+		if (writev(append_fd, iov, 2) < 0) {
+			perror("history: Failed to save");
+			close(append_fd);
+			append_fd = -1;
+		} else {
+			flock(append_fd, LOCK_UN);
+		}
+	}
+}
+
+/**
+ * @return Index of the newest entry, or -1 if there are none
+ */
+long histdb_newest() {
+	return histdb_previous(entry_count);
+}
+
+/**
+ * @return Index of the newest entry older than index, or -1 if there are none
+ */
+long histdb_previous(long index) {
+	for (long i = index - 1; i >= (long)oldest; i--) {
+		if (entries[i].alive) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/**
+ * @return Index of the oldest entry newer than index, or -1 if there are none
+ */
+long histdb_next(long index) {
+	for (size_t i = index + 1; i < entry_count; i++) {
+		if (entries[i].alive) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/**
+ * @param len Set to the length of the line, which isn't NUL terminated
+ */
+const char* histdb_line(long index, size_t* len) {
+	*len = entries[index].len;
+	return entries[index].line;
+}
+
+/**
+ * Find the newest entry containing some text
+ * @param query Text to look for
+ * @param before Only look at entries older than this index, -1 for all
+ * @return Index of the entry, or -1 if none matched
+ */
+long histdb_search(const char* query, long before) {
+	size_t query_len = strlen(query);
+	if (before < 0 || (size_t)before > entry_count) {
+		before = entry_count;
+	}
+
+	if (query_len < 3) {
+		// Too short to index, but short queries match something recent
+		for (long i = histdb_previous(before); i >= 0; i = histdb_previous(i)) {
+			if (memmem(entries[i].line, entries[i].len, query, query_len)) {
+				return i;
+			}
+		}
+		return -1;
+	}
+
+	// Every match has all of the query's trigrams, so only the entries
+	// under the rarest one need checking
+	const struct posting_list_t* rarest = NULL;
+	for (size_t i = 0; i + 3 <= query_len; i++) {
+		const struct posting_list_t* list = &postings[trigram_bucket(query + i)];
+		if (rarest == NULL || list->count < rarest->count) {
+			rarest = list;
+		}
+	}
+
+	// Newest first, starting from the last id before where we're searching
+	size_t lo = 0, hi = rarest->count;
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		if (rarest->ids[mid] < (uint32_t)before) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	for (size_t i = lo; i-- > 0;) {
+		const struct histdb_entry_t* entry = &entries[rarest->ids[i]];
+		if (entry->alive && memmem(entry->line, entry->len, query, query_len)) {
+			return rarest->ids[i];
+		}
+	}
+	return -1;
+}
@@ -0,0 +1,21 @@
+/**
+ * @file histdb.h
+ */
+
+#ifndef _HISTDB_H
+#define _HISTDB_H
+
+#include <stddef.h>
+
+#define HISTDB_DEFAULT_SIZE 10000
+
+int histdb_open(const char* path, size_t cap);
+void histdb_set_cap(size_t cap);
+void histdb_add(const char* line);
+long histdb_newest();
+long histdb_previous(long index);
+long histdb_next(long index);
+const char* histdb_line(long index, size_t* len);
+long histdb_search(const char* query, long before);
+
+#endif // _HISTDB_H
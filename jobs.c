@@ -0,0 +1,741 @@
+/**
+ * @file jobs.c
+ *
+ * The job table. Every pipeline we launch becomes a job keyed by its
+ * process group, whether it runs in the foreground or the background.
+ *
+ * Children are reaped as soon as they change state by the SIGCHLD handler,
+ * which can't safely touch the table, so it just queues what waitpid told
+ * it. jobs_update() applies the queue to the table whenever we need to look
+ * at it. Anything that launches processes blocks SIGCHLD until they're in
+ * the table, so a fast child can't be reaped before we know it's ours.
+ *
+ * Every stage keeps its own status, which $PIPESTATUS lists after a
+ * foreground job. With $PIPEFAIL on, a job's status is its rightmost
+ * failure rather than just its last stage's. A job started with a timeout
+ * prefix is killed once it's run that long. That's checked while we wait
+ * for it, so the parser won't put one in the background and bg won't
+ * continue one there.
+ */
+
+#define _GNU_SOURCE // ppoll
+#include "jobs.h"
+#include "execute.h"
+#include "trace.h"
+#include "zygote.h"
+#include "vars.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/wait.h>
+
+#define REAP_RING_SIZE 64
+#define TIMEOUT_GRACE 1.0    // Seconds between SIGTERM and SIGKILL
+#define TIMEOUT_STATUS 124   // Same as timeout(1)
+
+static struct job_t* jobs = NULL; // Oldest first
+static pid_t shell_pgid;
+static int interactive;
+
+// Filled by the SIGCHLD handler, emptied by jobs_update() with SIGCHLD
+// blocked, so the two never run at the same time
+static struct {
+	pid_t pid;
+	int status;
+	struct timespec when;
+	struct rusage usage;
+} reap_ring[REAP_RING_SIZE];
+static volatile sig_atomic_t ring_head = 0;
+static volatile sig_atomic_t ring_tail = 0;
+static volatile sig_atomic_t ring_overflow = 0;
+
+static void handle_sigchld(int sig) {
+	int saved_errno = errno;
+	while (1) {
+		int next = (ring_head + 1) % REAP_RING_SIZE;
+		if (next == ring_tail) {
+			// No room, leave the rest for jobs_update() to collect
+			ring_overflow = 1;
+			break;
+		}
+		int status;
+		pid_t pid = wait4(-1, &status, WNOHANG | WUNTRACED | WCONTINUED, &reap_ring[ring_head].usage);
+		if (pid <= 0) {
+			break;
+		}
+		// clock_gettime is async-signal-safe
+		clock_gettime(CLOCK_MONOTONIC, &reap_ring[ring_head].when);
+		reap_ring[ring_head].pid = pid;
+		reap_ring[ring_head].status = status;
+		ring_head = next;
+	}
+	// The zygote's children are reaped by the zygote, which sends us what it
+	// got before raising SIGCHLD. recv is async-signal-safe too.
+	while (!ring_overflow) {
+		int next = (ring_head + 1) % REAP_RING_SIZE;
+		if (next == ring_tail) {
+			ring_overflow = 1;
+			break;
+		}
+		struct zygote_status_t status;
+		if (!zygote_next_status(&status, 0)) {
+			break;
+		}
+		reap_ring[ring_head].pid = status.pid;
+		reap_ring[ring_head].status = status.status;
+		reap_ring[ring_head].when = status.when;
+		reap_ring[ring_head].usage = status.usage;
+		ring_head = next;
+	}
+	errno = saved_errno;
+}
+
+/**
+ * Set up job control. Also records the signal mask children start with.
+ * @param is_interactive Whether to print job status messages
+ */
+void jobs_init(int is_interactive) {
+	interactive = is_interactive;
+	shell_pgid = getpgrp();
+	sigprocmask(SIG_SETMASK, NULL, &sigmask);
+
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = handle_sigchld;
+	action.sa_flags = SA_RESTART; // Don't interrupt readline or getline
+	sigemptyset(&action.sa_mask);
+	if (sigaction(SIGCHLD, &action, NULL) < 0) {
+		perror("Failed to setup SIGCHLD handler");
+	}
+}
+
+/**
+ * Build the command line shown in job messages
+ */
+static char* describe(struct command_t* cmd) {
+	size_t len = 1;
+	for (struct command_t* stage = cmd; stage; stage = stage->pipe) {
+		for (size_t i = 0; i < stage->argc; i++) {
+			len += strlen(stage->argv[i]) + 1;
+		}
+		len += stage->in_file ? strlen(stage->in_file) + 3 : 0;
+		len += stage->out_file ? strlen(stage->out_file) + 3 : 0;
+		len += 3;
+	}
+
+	char* text = (char*)malloc(len);
+	char* w = text;
+	for (struct command_t* stage = cmd; stage; stage = stage->pipe) {
+		for (size_t i = 0; i < stage->argc; i++) {
+			if (i > 0) {
+				*w++ = ' ';
+			}
+			w = stpcpy(w, stage->argv[i]);
+		}
+		if (stage->in_file) {
+			w = stpcpy(stpcpy(w, " < "), stage->in_file);
+		}
+		if (stage->out_file) {
+			w = stpcpy(stpcpy(w, " > "), stage->out_file);
+		}
+		if (stage->pipe) {
+			w = stpcpy(w, " | ");
+		}
+	}
+	*w = '\0';
+	return text;
+}
+
+/**
+ * Start a new job. Its processes are added as they're launched.
+ * @param cmd Pipeline the job runs
+ * @param background Whether it was started with &
+ * @return The new job
+ */
+struct job_t* job_new(struct command_t* cmd, int background) {
+	struct job_t* job = (struct job_t*)calloc(1, sizeof(struct job_t));
+	job->text = describe(cmd);
+	job->background = background;
+	job->timed = cmd->timed;
+	job->timeout = cmd->timeout;
+	job->deadline = cmd->timeout > 0 ? now_seconds() + cmd->timeout : 0;
+	return job;
+}
+
+/**
+ * @return Seconds on the monotonic clock
+ */
+double now_seconds() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static struct process_t* new_process(struct job_t* job, pid_t pid, const char* name) {
+	if ((job->proc_count & (job->proc_count - 1)) == 0) {
+		// Out of room, proc_count is 0 or a power of two
+		size_t size = job->proc_count ? job->proc_count * 2 : 1;
+		job->procs = (struct process_t*)realloc(job->procs, sizeof(struct process_t) * size);
+	}
+	struct process_t* proc = &job->procs[job->proc_count++];
+	memset(proc, 0, sizeof(struct process_t));
+	proc->pid = pid;
+	proc->name = strdup(name);
+	return proc;
+}
+
+/**
+ * Add a launched process to a job. The job goes in the table with its
+ * first process, so builtins run by the shell itself never show up there.
+ * @param job Job to add to
+ * @param pid The process
+ * @param name Command it's running
+ * @param limits What it was limited to, or NULL
+ */
+void job_add(struct job_t* job, pid_t pid, const char* name, const struct limits_t* limits) {
+	if (job->id == 0) {
+		int id = 1;
+		struct job_t** tail = &jobs;
+		while (*tail) {
+			id = (*tail)->id + 1;
+			tail = &(*tail)->next;
+		}
+		job->id = id;
+		*tail = job;
+	}
+	struct process_t* proc = new_process(job, pid, name);
+	proc->state = kJobRunning;
+	proc->start = now_seconds();
+	if (limits) {
+		char text[256];
+		proc->limits = strdup(limits_describe(limits, text, sizeof(text)));
+	}
+}
+
+/**
+ * Add a stage the shell already ran itself, so it's part of the report
+ * @param job Job to add to
+ * @param name Builtin that ran
+ * @param start When it started
+ * @param usage What the shell used while it ran
+ * @param status Its exit status, in the form waitpid gives
+ */
+void job_add_shell(struct job_t* job, const char* name, double start, const struct rusage* usage, int status) {
+	new_process(job, 0, name);
+	// The shell only ever runs the leftmost stage, and the last stage's
+	// status has to stay last
+	struct process_t shell = job->procs[job->proc_count - 1];
+	memmove(job->procs + 1, job->procs, sizeof(struct process_t) * (job->proc_count - 1));
+	job->procs[0] = shell;
+
+	struct process_t* proc = &job->procs[0];
+	proc->state = kJobDone;
+	proc->status = status;
+	proc->start = start;
+	proc->end = now_seconds();
+	proc->usage = *usage;
+}
+
+/**
+ * Add a stage that couldn't be launched, so it still has a status
+ */
+void job_add_failed(struct job_t* job, const char* name) {
+	struct process_t* proc = new_process(job, 0, name);
+	proc->state = kJobDone;
+	proc->status = W_EXITCODE(127, 0);
+	proc->start = proc->end = now_seconds();
+}
+
+/**
+ * Let the user know a job was started in the background
+ */
+void job_started(struct job_t* job) {
+	if (interactive) {
+		printf("[%d] %d\n", job->id, job->pgid);
+	}
+}
+
+/**
+ * Remove a job from the table and free it
+ */
+void job_free(struct job_t* job) {
+	struct job_t** link = &jobs;
+	while (*link && *link != job) {
+		link = &(*link)->next;
+	}
+	if (*link) {
+		*link = job->next;
+	}
+	for (size_t i = 0; i < job->proc_count; i++) {
+		free(job->procs[i].name);
+		free(job->procs[i].limits);
+	}
+	free(job->procs);
+	free(job->text);
+	free(job);
+}
+
+enum job_state_t job_state(struct job_t* job) {
+	enum job_state_t state = kJobDone;
+	for (size_t i = 0; i < job->proc_count; i++) {
+		if (job->procs[i].state == kJobRunning) {
+			return kJobRunning;
+		} else if (job->procs[i].state == kJobStopped) {
+			state = kJobStopped;
+		}
+	}
+	return state;
+}
+
+/**
+ * @return A status from waitpid the way $? reports it
+ */
+static int exit_status(int status) {
+	if (WIFSIGNALED(status)) {
+		return 128 + WTERMSIG(status);
+	} else if (WIFSTOPPED(status)) {
+		return 128 + WSTOPSIG(status);
+	}
+	return WEXITSTATUS(status);
+}
+
+/**
+ * @return Exit status of the job's last process, or with $PIPEFAIL on of
+ *         the last one that failed, the way $? reports it
+ */
+int job_status(struct job_t* job) {
+	if (job->timed_out) {
+		return TIMEOUT_STATUS;
+	}
+	if (job->proc_count == 0) {
+		return 0;
+	}
+	if (var_enabled("PIPEFAIL")) {
+		for (size_t i = job->proc_count; i-- > 0;) {
+			int status = exit_status(job->procs[i].status);
+			if (status != 0) {
+				return status;
+			}
+		}
+		return 0;
+	}
+	return exit_status(job->procs[job->proc_count - 1].status);
+}
+
+/**
+ * Set $PIPESTATUS to each stage's exit status, space separated
+ */
+void job_set_pipestatus(struct job_t* job) {
+	// Statuses are at most 3 digits
+	char* text = (char*)malloc(job->proc_count * 4 + 1);
+	char* w = text;
+	for (size_t i = 0; i < job->proc_count; i++) {
+		w += sprintf(w, i ? " %d" : "%d", exit_status(job->procs[i].status));
+	}
+	*w = '\0';
+	var_set("PIPESTATUS", text, 0);
+	free(text);
+}
+
+static void record(pid_t pid, int status, const struct timespec* when, const struct rusage* usage) {
+	for (struct job_t* job = jobs; job; job = job->next) {
+		for (size_t i = 0; i < job->proc_count; i++) {
+			struct process_t* proc = &job->procs[i];
+			if (proc->pid != pid) {
+				continue;
+			}
+			if (WIFCONTINUED(status)) {
+				proc->state = kJobRunning;
+			} else if (WIFSTOPPED(status)) {
+				proc->state = kJobStopped;
+				proc->status = status;
+			} else {
+				proc->state = kJobDone;
+				proc->status = status;
+				proc->end = when->tv_sec + when->tv_nsec / 1e9;
+				proc->usage = *usage;
+				trace_span(proc->name, "stage", proc->start, proc->end, job->pgid, pid,
+					"\"pgid\": %d, \"status\": %d", (int)job->pgid, status);
+			}
+			job->notify = 1;
+			return;
+		}
+	}
+}
+
+/**
+ * Apply everything the SIGCHLD handler collected to the job table.
+ * Must be called with SIGCHLD blocked.
+ */
+static void drain() {
+	while (ring_tail != ring_head) {
+		record(reap_ring[ring_tail].pid, reap_ring[ring_tail].status,
+			&reap_ring[ring_tail].when, &reap_ring[ring_tail].usage);
+		ring_tail = (ring_tail + 1) % REAP_RING_SIZE;
+	}
+	if (ring_overflow) {
+		ring_overflow = 0;
+		int status;
+		pid_t pid;
+		struct timespec when;
+		struct rusage usage;
+		while ((pid = wait4(-1, &status, WNOHANG | WUNTRACED | WCONTINUED, &usage)) > 0) {
+			clock_gettime(CLOCK_MONOTONIC, &when);
+			record(pid, status, &when, &usage);
+		}
+		struct zygote_status_t zygote_status;
+		while (zygote_next_status(&zygote_status, 0)) {
+			record(zygote_status.pid, zygote_status.status, &zygote_status.when, &zygote_status.usage);
+		}
+	}
+}
+
+/**
+ * Bring the job table up to date with what our children have been doing
+ */
+void jobs_update() {
+	sigset_t mask, old_mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &mask, &old_mask);
+	drain();
+	sigprocmask(SIG_SETMASK, &old_mask, NULL);
+}
+
+/**
+ * Sleep until at least one child changes state, then bring the job table up
+ * to date. Must be called with SIGCHLD blocked.
+ */
+void jobs_wait_change() {
+	if (ring_tail == ring_head && !ring_overflow) {
+		double trace_start = trace_enabled ? now_seconds() : 0;
+		sigset_t wait_mask;
+		sigprocmask(SIG_BLOCK, NULL, &wait_mask);
+		sigdelset(&wait_mask, SIGCHLD);
+		sigsuspend(&wait_mask);
+		if (trace_enabled) {
+			trace_span("wait", "shell", trace_start, now_seconds(), getpid(), getpid(), NULL);
+		}
+	}
+	drain();
+}
+
+static void print_usage(const char* name, double real, double user, double sys, const struct rusage* usage) {
+	fprintf(stderr, "%-16.16s %8.3f %8.3f %8.3f %9ld %7ld %7ld %8ld %8ld\n", name, real, user, sys,
+		usage->ru_maxrss, usage->ru_nvcsw, usage->ru_nivcsw, usage->ru_minflt, usage->ru_majflt);
+}
+
+static double seconds(const struct timeval* tv) {
+	return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+/**
+ * Print what each stage of a finished job used, and the totals. Stages that
+ * ran at the same time are added up, except max RSS which is the largest.
+ */
+void job_report(struct job_t* job) {
+	struct rusage total;
+	memset(&total, 0, sizeof(total));
+	double user = 0, sys = 0;
+	double start = 0, end = 0;
+
+	fprintf(stderr, "%-16s %8s %8s %8s %9s %7s %7s %8s %8s\n",
+		"stage", "real", "user", "sys", "maxrss_kb", "vcsw", "ivcsw", "minflt", "majflt");
+	for (size_t i = 0; i < job->proc_count; i++) {
+		struct process_t* proc = &job->procs[i];
+		double proc_user = seconds(&proc->usage.ru_utime);
+		double proc_sys = seconds(&proc->usage.ru_stime);
+		print_usage(proc->name, proc->end - proc->start, proc_user, proc_sys, &proc->usage);
+
+		user += proc_user;
+		sys += proc_sys;
+		if (proc->usage.ru_maxrss > total.ru_maxrss) {
+			total.ru_maxrss = proc->usage.ru_maxrss;
+		}
+		total.ru_nvcsw += proc->usage.ru_nvcsw;
+		total.ru_nivcsw += proc->usage.ru_nivcsw;
+		total.ru_minflt += proc->usage.ru_minflt;
+		total.ru_majflt += proc->usage.ru_majflt;
+		if (i == 0 || proc->start < start) {
+			start = proc->start;
+		}
+		if (proc->end > end) {
+			end = proc->end;
+		}
+	}
+	if (job->proc_count > 1) {
+		print_usage("total", end - start, user, sys, &total);
+	}
+	for (size_t i = 0; i < job->proc_count; i++) {
+		if (job->procs[i].limits) {
+			fprintf(stderr, "%-16.16s limits: %s\n", job->procs[i].name, job->procs[i].limits);
+		}
+	}
+}
+
+/**
+ * Take a finished job out of the table, reporting on it first if it was timed
+ */
+static void forget(struct job_t* job) {
+	if (job->timed) {
+		job_report(job);
+	}
+	job_free(job);
+}
+
+/**
+ * Wait until a job finishes or stops. A finished job is removed from the table.
+ * @param job Job to wait for
+ * @param foreground Whether to give it the terminal while it runs
+ * @return The job's exit status
+ */
+int job_wait(struct job_t* job, int foreground) {
+	sigset_t mask, old_mask, wait_mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &mask, &old_mask);
+	wait_mask = old_mask;
+	sigdelset(&wait_mask, SIGCHLD);
+
+	if (foreground) {
+		// Give child group control of terminal
+		tcsetpgrp(STDIN_FILENO, job->pgid);
+	}
+
+	int murdered = 0;
+	double trace_start = trace_enabled ? now_seconds() : 0;
+	drain();
+	while (job_state(job) == kJobRunning) {
+		if (job->deadline == 0) {
+			sigsuspend(&wait_mask);
+		} else {
+			double left = job->deadline - now_seconds();
+			if (left <= 0) {
+				// Ask it to stop first, and if it won't, make it
+				killpg(job->pgid, job->timed_out ? SIGKILL : SIGTERM);
+				job->deadline = job->timed_out ? 0 : now_seconds() + TIMEOUT_GRACE;
+				job->timed_out = 1;
+				continue;
+			}
+			// sigsuspend that gives up at the deadline
+			struct timespec ts = {(time_t)left, (left - (time_t)left) * 1e9};
+			ppoll(NULL, 0, &ts, &wait_mask);
+		}
+		drain();
+
+		for (size_t i = 0; i < job->proc_count && !murdered; i++) {
+			int status = job->procs[i].status;
+			if (job->procs[i].state == kJobDone && WIFEXITED(status) && WEXITSTATUS(status) == 127) {
+				/*printf("Child died horribly, kill everyone in pgid (%d)\n", pgid);*/
+				killpg(job->pgid, SIGINT);
+				murdered = 1;
+			}
+		}
+	}
+
+	if (trace_enabled) {
+		trace_span("wait", "shell", trace_start, now_seconds(), getpid(), getpid(),
+			"\"job\": %d, \"pgid\": %d", job->id, (int)job->pgid);
+	}
+
+	if (foreground) {
+		// Get control of terminal back
+		tcsetpgrp(STDIN_FILENO, shell_pgid);
+
+		if (job->timed_out) {
+			printf("Timed out after %g seconds\n", job->timeout);
+		}
+
+		// The exec will replace the signal handler, so you can't capture it and make it print something
+		// so use the exit status
+		int child_killed = 0;
+		for (size_t i = 0; i < job->proc_count && !job->timed_out; i++) {
+			int status = job->procs[i].status;
+			if (job->procs[i].state == kJobDone && WIFSIGNALED(status)) {
+				if (!child_killed) {
+					// Personally, I don't want to print the \n first, other shells don't, but it makes sure
+					// our message is on its own line and if I don't do it it'll seem like a mistake rather
+					// than a design decision
+					printf("\n");
+					child_killed = 1;
+				}
+				printf("Child %d killed with signal %d (%s)\n", job->procs[i].pid, WTERMSIG(status), strsignal(WTERMSIG(status)));
+			}
+		}
+	}
+
+	int status = job_status(job);
+	if (foreground) {
+		job_set_pipestatus(job);
+	}
+	if (job_state(job) == kJobStopped) {
+		// It's a background job now, until someone fg's it
+		if (foreground && interactive) {
+			printf("\n[%d]+  Stopped\t\t%s\n", job->id, job->text);
+		}
+		job->background = 1;
+		job->notify = 0;
+	} else {
+		forget(job);
+	}
+
+	sigprocmask(SIG_SETMASK, &old_mask, NULL);
+	return status;
+}
+
+/**
+ * Continue a stopped (or background) job
+ * @param job Job to continue
+ * @param foreground Whether to bring it to the foreground and wait for it
+ * @return The job's exit status if it was waited for, else 0
+ */
+int job_continue(struct job_t* job, int foreground) {
+	for (size_t i = 0; i < job->proc_count; i++) {
+		if (job->procs[i].state == kJobStopped) {
+			job->procs[i].state = kJobRunning;
+		}
+	}
+	job->notify = 0;
+
+	if (foreground) {
+		job->background = 0;
+		printf("%s\n", job->text);
+		fflush(stdout);
+	} else {
+		printf("[%d]+ %s &\n", job->id, job->text);
+	}
+
+	if (killpg(job->pgid, SIGCONT) < 0) {
+		perror("Failed to continue job");
+	}
+
+	return foreground ? job_wait(job, 1) : 0;
+}
+
+/**
+ * Find a job from a job spec
+ * @param spec %n for job n, %%, %+ or NULL for the current job, %- for the
+ *             previous one, or a process id
+ * @return The job, or NULL if there's no such job
+ */
+struct job_t* job_find(const char* spec) {
+	struct job_t* current = NULL;
+	struct job_t* previous = NULL;
+	for (struct job_t* job = jobs; job; job = job->next) {
+		previous = current;
+		current = job;
+	}
+
+	if (spec == NULL || strcmp(spec, "%") == 0 || strcmp(spec, "%%") == 0 || strcmp(spec, "%+") == 0) {
+		return current;
+	} else if (strcmp(spec, "%-") == 0) {
+		return previous;
+	}
+
+	char* end;
+	long n = strtol(spec[0] == '%' ? spec + 1 : spec, &end, 10);
+	if (*end != '\0' || end == spec) {
+		return NULL;
+	}
+	for (struct job_t* job = jobs; job; job = job->next) {
+		if (spec[0] == '%') {
+			if (job->id == n) {
+				return job;
+			}
+		} else {
+			for (size_t i = 0; i < job->proc_count; i++) {
+				if (job->procs[i].pid == n && n > 0) {
+					return job;
+				}
+			}
+		}
+	}
+	return NULL;
+}
+
+static char marker(struct job_t* job) {
+	if (job->next == NULL) {
+		return '+';
+	} else if (job->next->next == NULL) {
+		return '-';
+	}
+	return ' ';
+}
+
+static void print_job(struct job_t* job) {
+	enum job_state_t state = job_state(job);
+	if (state == kJobRunning) {
+		printf("[%d]%c  Running\t\t%s &\n", job->id, marker(job), job->text);
+	} else if (state == kJobStopped) {
+		printf("[%d]%c  Stopped\t\t%s\n", job->id, marker(job), job->text);
+	} else if (job_status(job) == 0) {
+		printf("[%d]%c  Done\t\t\t%s\n", job->id, marker(job), job->text);
+	} else {
+		printf("[%d]%c  Exit %d\t\t%s\n", job->id, marker(job), job_status(job), job->text);
+	}
+}
+
+/**
+ * Tell the user about background jobs that finished or stopped since we
+ * last checked, and forget the finished ones
+ * @param quiet Forget finished jobs without saying anything
+ */
+void jobs_notify(int quiet) {
+	jobs_update();
+	struct job_t* job = jobs;
+	while (job) {
+		struct job_t* next = job->next;
+		if (job->background && job->notify && job_state(job) != kJobRunning) {
+			if (!quiet && interactive) {
+				print_job(job);
+			}
+			job->notify = 0;
+			if (job_state(job) == kJobDone) {
+				forget(job);
+			}
+		}
+		job = next;
+	}
+}
+
+/**
+ * List every job, forgetting the finished ones
+ */
+void jobs_print() {
+	jobs_update();
+	struct job_t* job = jobs;
+	while (job) {
+		struct job_t* next = job->next;
+		print_job(job);
+		job->notify = 0;
+		if (job_state(job) == kJobDone) {
+			forget(job);
+		}
+		job = next;
+	}
+}
+
+/**
+ * Wait for every running background job to finish
+ * @return Exit status of the last one waited for
+ */
+int jobs_wait_all() {
+	int status = 0;
+	jobs_update();
+	struct job_t* job = jobs;
+	while (job) {
+		struct job_t* next = job->next;
+		if (job_state(job) != kJobStopped) {
+			status = job_wait(job, 0);
+			// Waiting may have freed other finished jobs too, so start over
+			next = jobs;
+		}
+		job = next;
+	}
+	return status;
+}
@@ -0,0 +1,62 @@
+/**
+ * @file jobs.h
+ */
+
+#ifndef _JOBS_H
+#define _JOBS_H
+
+#include "parser.h"
+#include "rlimits.h"
+#include <sys/types.h>
+#include <sys/resource.h>
+
+enum job_state_t {kJobRunning, kJobStopped, kJobDone};
+
+struct process_t {
+	pid_t pid;  // 0 for a stage the shell ran itself
+	int status; // From waitpid, once it isn't running
+	enum job_state_t state;
+	char* name;
+	double start, end;    // Launched and reaped, in seconds on the monotonic clock
+	struct rusage usage;  // From wait4, once it's done
+	char* limits;         // What limit gave it, described, or NULL
+};
+
+// A pipeline we launched, identified by its process group
+struct job_t {
+	int id;
+	pid_t pgid;
+	struct process_t* procs;
+	size_t proc_count;
+	char* text;     // Command line, for messages
+	int background;
+	int notify;     // Changed state in the background and the user hasn't been told
+	int timed;      // Report resource usage when it's done
+	double timeout;  // Seconds it may run for, from a timeout prefix, or 0
+	double deadline; // When it times out, or when to stop asking nicely once it has
+	int timed_out;   // Ran past its timeout and was killed
+	struct job_t* next;
+};
+
+void jobs_init(int is_interactive);
+struct job_t* job_new(struct command_t* cmd, int background);
+void job_add(struct job_t* job, pid_t pid, const char* name, const struct limits_t* limits);
+void job_add_shell(struct job_t* job, const char* name, double start, const struct rusage* usage, int status);
+void job_add_failed(struct job_t* job, const char* name);
+void job_report(struct job_t* job);
+double now_seconds();
+void job_started(struct job_t* job);
+void job_free(struct job_t* job);
+enum job_state_t job_state(struct job_t* job);
+int job_status(struct job_t* job);
+void job_set_pipestatus(struct job_t* job);
+int job_wait(struct job_t* job, int foreground);
+int job_continue(struct job_t* job, int foreground);
+struct job_t* job_find(const char* spec);
+void jobs_update();
+void jobs_wait_change();
+void jobs_notify(int quiet);
+void jobs_print();
+int jobs_wait_all();
+
+#endif // _JOBS_H
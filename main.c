@@ -4,26 +4,31 @@
 #include "builtins.h"
 #include "utility.h"
 #include "parser.h"
+#include "arena.h"
+#include "prompt.h"
+#include "execute.h"
+#include "jobs.h"
+#include "stats.h"
+#include "trace.h"
+#include "zygote.h"
+#include "vars.h"
+#include "histdb.h"
+#include "complete.h"
+#include "cmdcache.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <readline/readline.h>
 #include <readline/history.h>
 #include <unistd.h>
 #include <sys/types.h>
-#include <sys/wait.h>
-#include <sys/stat.h>
-#include <fcntl.h>
 #include <signal.h>
+#include <errno.h>
 
-extern struct builtin_t builtins[];
-
-status_t execute_command(struct command_t* cmd);
-status_t execute_command_child(struct command_t* cmd, int pipefd[], pid_t pgid);
-status_t execute_builtin(struct command_t* cmd, int pipefd[]);
-status_t execute_external(struct command_t* cmd);
-
-pid_t pipeline_pgid;
-sigset_t sigmask;
+#define SCRIPT_BUFFER_SIZE (1 << 16)
+#define LINE_ARENA_SIZE (1 << 14)
+#define READLINE_HISTORY 1000 // Entries readline gets for up-arrow
+#define SEARCH_QUERY_SIZE 256
 
 void handle_sigint(int sig) {
 	// printf is not async-signal-safe (see man 7 signal)
@@ -32,435 +37,322 @@ void handle_sigint(int sig) {
 	rl_forced_update_display(); // Redisplay prompt.. probably safe?
 }
 
-int main(int argc, char** argv) {
-#ifdef RUNTESTS
-	parser_tests();
-	return 0;
-#endif
-
-	// Use sigaction because on Paris the handler is uninstalled for some reason
-	// after being triggered once
-	struct sigaction action;
-	memset(&action, 0, sizeof(sigaction));
-	action.sa_handler = handle_sigint;
-	if (sigaction(SIGINT, &action, NULL) < 0) {
-		perror("Failed to setup signal handler");
-	}
-
-	char* s;
-	char* prompt = buildPrompt();
-	status_t ret;
-
-	// Initialize shell by ignoring certain job control signals
-	signal(SIGTSTP, SIG_IGN);
-	signal(SIGTTIN, SIG_IGN);
-	signal(SIGTTOU, SIG_IGN);
-
-	pipeline_pgid = 0;
-
-	while ((s = readline(prompt))) {
-
-		add_history(s);
-
-		struct command_t* cmd = new_command();
-		enum parse_error_t pe = parse(cmd, s);
-
-		if (pe == kUnexpectedEnd) {
-			printf("Unexpected end of command\n");
-		} else if (pe == kRepeatedRedirect) {
-			printf("Redirection was repeated\n");
-		} else if (pe == kArgumentAfterRedirect) {
-			printf("Redirection must occur after arguments\n");
-		} else if (pe == kNoArgs) {
-			printf("A command must be specified\n");
-		} else if (cmd->argc > 0) {
-			// We're a command, execute it
-			ret = execute_command(cmd);
-
-			// EXIT is the only return we really care about, errors
-			// have already been taken care of
-			if (ret == BUILTIN_EXIT) {
-				// Clean up
-				delete_command(cmd);
-				break;
-			}
+/**
+ * Put the history file to use, and give readline the newest entries
+ */
+void history_init() {
+	const char* path = var_get("HISTFILE");
+	const char* home = var_get("HOME");
+	char* default_path = NULL;
+	if (path == NULL) {
+		if (home == NULL) {
+			return;
 		}
-
-		delete_command(cmd);
-		free(s);
-		free(prompt);
-		prompt = buildPrompt();
-
+		default_path = (char*)malloc(strlen(home) + sizeof("/.shell_history"));
+		sprintf(default_path, "%s/.shell_history", home);
+		path = default_path;
+	}
+	const char* size = var_get("HISTSIZE");
+	histdb_open(path, size && atol(size) > 0 ? atol(size) : HISTDB_DEFAULT_SIZE);
+	free(default_path);
+
+	// Readline's own list is only for up-arrow, it doesn't need them all
+	stifle_history(READLINE_HISTORY);
+	long first = -1;
+	int count = 0;
+	for (long i = histdb_newest(); i >= 0 && count < READLINE_HISTORY; i = histdb_previous(i)) {
+		first = i;
+		count++;
+	}
+	for (long i = first; i >= 0; i = histdb_next(i)) {
+		size_t len;
+		const char* line = histdb_line(i, &len);
+		char* copy = strndup(line, len);
+		add_history(copy);
+		free(copy);
 	}
-	// s will be NULL on ctrl-d with no buffer, but
-	// that's okay because then free does nothing
-	free(s);
-	free(prompt);
-	return 0;
 }
 
-status_t execute_command(struct command_t* cmd) {
-	status_t ret;
-	size_t child_count = 0;
-
-	int fd[2] = {STDIN_FILENO, STDOUT_FILENO};
-	int builtin_idx = find_builtin(cmd);
-
-	// Block signals until we finish with the pipeline
-	sigset_t mask;
-	sigemptyset(&mask);
-	/*sigaddset(&mask, SIGINT);  // We want to block INT*/
-	sigaddset(&mask, SIGCHLD); // and CHLD
-	sigprocmask(SIG_BLOCK, &mask, &sigmask);
-
-	if (cmd->pipe) {
-		ret = PIPE_OK;
-		// We have a pipeline, need to set up all the pipage
-		int pipefd[2];
-
-		while (cmd) {
-			if (child_count > 0) {
-				// We have somewhere to pipe from
-				if (fd[0] >= 0 && fd[0] != STDIN_FILENO) {
-					if (close(fd[0]) < 0) {
-						perror("Failed to close input pipe");
-						ret = PIPE_ERROR;
-						break;
-					}
-				}
-				fd[0] = pipefd[0];
-			} else {
-				fd[0] = STDIN_FILENO;
-			}
-
-			if (cmd->pipe) {
-				// We have somewhere to pipe to
-
-				if (pipe(pipefd) < 0) {
-					perror("Failed to create pipe");
-					ret = PIPE_ERROR;
-					break;
-				}
-
-				fd[1] = pipefd[1];
-
-				if (child_count == 0) {
-					// We want the child to close this, and not use it, so set it to negative
-					// so set it to negative to signify this
-					fd[0] = -pipefd[0];
-				}
-			} else {
-				fd[1] = STDOUT_FILENO;
-			}
-
-			if (child_count > 0 || builtin_idx < 0) {
-				// We're either not builtin, or not leftmost
-				// so we want to execute it as a child
-				pid_t pid = execute_command_child(cmd, fd, pipeline_pgid);
-				if (pipeline_pgid == 0) {
-					pipeline_pgid = pid;
-				}
-				if (setpgid(pid, pipeline_pgid) < 0) {
-					perror("Failed to set process group");
-				}
-			} else {
-				// We're a builtin and leftmost, execute right now
-				execute_builtin(cmd, fd);
-			}
-			child_count++;
-
-			if (fd[1] != STDOUT_FILENO) {
-				if (close(pipefd[1]) < 0) {
-					perror("Failed to close output pipe");
-					ret = PIPE_ERROR;
-				}
-			}
-
-			cmd = cmd->pipe;
-		}
-
-		if (child_count > 0) {
-			if (close(pipefd[0]) < 0) {
-				perror("Failed to close input pipe");
-				ret = PIPE_ERROR;
-			}
-		}
-
-	} else {
-		// No pipeline, we can just run the command regularly
-		if (builtin_idx < 0) {
-			pipeline_pgid = execute_command_child(cmd, fd, 0);
-			if (setpgid(pipeline_pgid, pipeline_pgid) < 0) {
-				perror("Failed to set process group");
+/**
+ * Ctrl-R: search back through the whole history as the query is typed.
+ * Ctrl-R again finds an older match, Ctrl-G gives up, and any other key
+ * takes the match and then does what it normally would.
+ */
+int reverse_search(int count, int key) {
+	char query[SEARCH_QUERY_SIZE] = "";
+	size_t query_len = 0;
+	long match = -1;
+	char* original = strdup(rl_line_buffer);
+	int c;
+	while (1) {
+		size_t len = 0;
+		const char* line = match >= 0 ? histdb_line(match, &len) : "";
+		rl_message("(%sreverse-i-search)`%s': %.*s", match < 0 && query_len ? "failed " : "",
+		           query, (int)len, line);
+		if ((c = rl_read_key()) == key) {
+			long older = match >= 0 ? histdb_search(query, match) : -1;
+			match = older >= 0 ? older : match;
+		} else if (c == 127 || c == '\b') {
+			if (query_len > 0) {
+				query[--query_len] = '\0';
 			}
-			ret = EXTERNAL_OK;
+			match = query_len ? histdb_search(query, -1) : -1;
+		} else if (c >= ' ' && c < 127 && query_len < sizeof(query) - 1) {
+			query[query_len++] = c;
+			query[query_len] = '\0';
+			// The current match might still do
+			match = histdb_search(query, match >= 0 ? match + 1 : -1);
 		} else {
-			ret = execute_builtin(cmd, fd);
+			break;
 		}
-		child_count++;
 	}
-
-	if (child_count > 0 && builtin_idx >= 0) {
-		child_count--; // One of our childen was fake, no need to wait for it
-	}
-
-	if (child_count > 0 && ret == PIPE_ERROR) {
-		// Murder the children
-		/*printf("Murdering the children %d (%ld of them)\n", pipeline_pgid, child_count);*/
-		if (pipeline_pgid && killpg(pipeline_pgid, SIGINT) < 0) {
-			perror("Failed to murder the children");
+	rl_clear_message();
+
+	if (c == 7) { // Ctrl-G
+		rl_replace_line(original, 0);
+	} else if (match >= 0) {
+		size_t len;
+		const char* line = histdb_line(match, &len);
+		char* copy = strndup(line, len);
+		rl_replace_line(copy, 0);
+		free(copy);
+		if (c != 27) { // Escape just ends the search
+			rl_execute_next(c);
 		}
+	} else if (c != 27) {
+		rl_execute_next(c);
 	}
+	rl_point = rl_end;
+	free(original);
+	return 0;
+}
 
-	// Give child group control of terminal
-	if (pipeline_pgid) {
-		tcsetpgrp(STDIN_FILENO, pipeline_pgid);
+/**
+ * @return Whether a word starting at start would be a command name, i.e.
+ *         everything before it in its stage is prefixes like time and limit
+ */
+int command_position(int start) {
+	int stage = start;
+	while (stage > 0 && rl_line_buffer[stage - 1] != '|') {
+		stage--;
+	}
+	char* words = strndup(rl_line_buffer + stage, start - stage);
+	size_t count = 0;
+	for (char* w = words; *w; w++) {
+		count += (*w != ' ' && *w != '\t') && (w == words || w[-1] == ' ' || w[-1] == '\t');
 	}
+	char** argv = (char**)malloc(sizeof(char*) * (count + 1));
+	char* save;
+	size_t argc = 0;
+	for (char* w = strtok_r(words, " \t", &save); w; w = strtok_r(NULL, " \t", &save)) {
+		argv[argc++] = w;
+	}
+	argv[argc] = NULL;
 
-	// Done creating pipeline, restore signal mask
-	sigprocmask(SIG_SETMASK, &sigmask, NULL);
+	int ret = prefix_words(argv, stage == 0) == argc;
+	free(argv);
+	free(words);
+	return ret;
+}
 
+/**
+ * Tab: command names where a command goes, otherwise readline's own
+ * filename completion, which covers arguments and redirect targets
+ */
+char** complete_line(const char* text, int start, int end) {
+	if (strchr(text, '/') || !command_position(start)) {
+		rl_sort_completion_matches = 1;
+		return NULL;
+	}
+	rl_attempted_completion_over = 1;
+	rl_sort_completion_matches = 0; // They come out of the trie in order
+	return complete_command(text);
+}
 
-	int child_killed = 0;
-	while (child_count--) { // Wait for each of the children
-		int status = 0;
-		pid_t pid = waitpid(-1, &status, 0);
-		// The exec will replace the signal handler, so you can't capture it and make it print something
-		// so use the exit status
-		if (WIFSIGNALED(status)) {
-			if (!child_killed) {
-				// Personally, I don't want to print the \n first, other shells don't, but it makes sure
-				// our message is on its own line and if I don't do it it'll seem like a mistake rather
-				// than a design decision
-				printf("\n");
-				child_killed = 1;
-			}
-			printf("Child %d killed with signal %d (%s)\n", pid, WTERMSIG(status), strsignal(WTERMSIG(status)));
-		}
-		if (WEXITSTATUS(status) == 127) {
-			/*printf("Child died horribly, kill everyone in pgid (%d)\n", pgid);*/
-			killpg(pipeline_pgid, SIGINT);
-			ret = EXTERNAL_ERROR;
+/**
+ * Parse and execute a single line of input
+ * @param s Line to run, it gets modified by the parser
+ * @return BUILTIN_EXIT if the shell should exit
+ */
+status_t run_line(char* s) {
+	status_t ret = BUILTIN_OK;
+	struct command_t* cmd = NULL;
+	enum parse_error_t pe = kParseOK;
+	double trace_start = trace_enabled ? now_seconds() : 0;
+	STATS_START(parse_start);
+	char* raw = NULL;
+	if (cmdcache_cacheable(s) && (cmd = cmdcache_lookup(s, &line_arena)) == NULL) {
+		// parse() works in place, so keep the line as it was for the cache
+		size_t len = strlen(s) + 1;
+		raw = (char*)memcpy(arena_alloc(&line_arena, len), s, len);
+	}
+	if (cmd == NULL) {
+		cmd = new_command(&line_arena);
+		pe = parse(cmd, s);
+		if (raw && pe == kParseOK) {
+			cmdcache_store(raw, cmd);
 		}
 	}
+	STATS_STOP(kStatParse, parse_start);
+	if (trace_enabled) {
+		trace_span("parse", "shell", trace_start, now_seconds(), getpid(), getpid(), NULL);
+	}
 
-	pipeline_pgid = 0;
+	if (pe == kUnexpectedEnd) {
+		printf("Unexpected end of command\n");
+	} else if (pe == kRepeatedRedirect) {
+		printf("Redirection was repeated\n");
+	} else if (pe == kArgumentAfterRedirect) {
+		printf("Redirection must occur after arguments\n");
+	} else if (pe == kNoArgs) {
+		printf("A command must be specified\n");
+	} else if (pe == kBackgroundNotLast) {
+		printf("& must be at the end of the command\n");
+	} else if (pe == kBadSubstitution) {
+		printf("Bad substitution\n");
+	} else if (pe == kTimeoutInBackground) {
+		printf("timeout can't be used with &\n");
+	} else if (cmd->argc > 0) {
+		// We're a command, execute it
+		ret = execute_command(cmd);
+	}
+	if (pe != kParseOK) {
+		last_status = 2;
+	}
 
-	// Get control of terminal back
-	tcsetpgrp(STDIN_FILENO, getpgid(0));
+	arena_reset(&line_arena);
 	return ret;
 }
 
-status_t execute_command_child(struct command_t* cmd, int pipefd[], pid_t pgid) {
-	pid_t pid = 0;
-	if ((pid = fork()) < 0) {
-		close(pipefd[0]);
-		close(pipefd[1]);
-		perror("Error forking");
-	} else if (pid == 0) {
-		// Child
-		// Delete signal handlers
-		if (signal(SIGINT, SIG_DFL) == SIG_ERR ||
-			signal(SIGTSTP, SIG_DFL) == SIG_ERR ||
-			signal(SIGTTIN, SIG_DFL) == SIG_ERR ||
-			signal(SIGTTOU, SIG_DFL) == SIG_ERR) {
-			perror("Failed to delete signal handler");
-		}
-
-		// Unblock signals
-		sigprocmask(SIG_SETMASK, &sigmask, NULL);
-
-		if (pgid > 0) {
-			// Set a process group
-			if (setpgid(0, pgid) < 0) {
-				perror("child: Failed to set process group");
-			}
-		}
-
-		if (pipefd[0] != STDIN_FILENO) {
-			if (pipefd[0] >= 0) {
-				if (dup2(pipefd[0], STDIN_FILENO) < 0) {
-					perror("Failed to redirect stdin");
-				}
-			} else {
-				pipefd[0] = -pipefd[0];
-			}
-			if (close(pipefd[0]) < 0) {
-				perror("Failed to close input pipe");
-			}
+/**
+ * Run every line of a script, without any of the interactive niceties
+ * @param file Script to read from
+ * @return Exit status of the last command
+ */
+int run_script(FILE* file) {
+	// Scripts can be tens of thousands of lines, so read them in big gulps
+	setvbuf(file, NULL, _IOFBF, SCRIPT_BUFFER_SIZE);
+
+	char* line = NULL;
+	size_t line_size = 0;
+	ssize_t len;
+	while ((len = getline(&line, &line_size, file)) >= 0) {
+		if (len > 0 && line[len - 1] == '\n') {
+			line[len - 1] = '\0';
 		}
-
-		if (pipefd[1] != STDOUT_FILENO) {
-			if (pipefd[1] >= 0) {
-				if (dup2(pipefd[1], STDOUT_FILENO) < 0) {
-					perror("Failed to redirect stdout");
-				}
-			} else {
-				pipefd[1] = -pipefd[1];
-			}
-			if (close(pipefd[1]) < 0) {
-				perror("Failed to close output pipe");
-			}
+		char* start = line;
+		while (*start == ' ' || *start == '\t') { start++; }
+		if (*start == '#') {
+			// Comment (or a #! line)
+			continue;
 		}
-
-		int fd[2] = {STDIN_FILENO, STDOUT_FILENO};
-		status_t ret = execute_builtin(cmd, fd);
-		if (ret == BUILTIN_EXIT) {
-			// Well, we're in a fork, so this will just
-			// kill the fork.
-			close(STDIN_FILENO);
-			exit(127);
-		} else if (ret == BUILTIN_MISSING) {
-			execute_external(cmd);
-			// If we're here, we failed to run the child and have already printed
-			// out an error.
-			exit(127);
+		// EXIT is the only return we really care about, errors
+		// have already been taken care of
+		if (run_line(line) == BUILTIN_EXIT) {
+			break;
 		}
-		exit(0);
+		// Forget finished background jobs, nobody's there to tell
+		jobs_notify(1);
 	}
-	return pid;
+	free(line);
+	return last_status;
 }
 
-status_t execute_builtin(struct command_t* cmd, int pipefd[]) {
-	status_t ret = BUILTIN_MISSING;
-	int builtin_idx = find_builtin(cmd);
-
-	if (builtin_idx < 0) {
-		return BUILTIN_MISSING;
+/**
+ * Run the lines given with -c
+ * @param commands Newline separated commands
+ * @return Exit status of the last command
+ */
+int run_string(char* commands) {
+	char* line;
+	while ((line = strsep(&commands, "\n")) != NULL) {
+		if (run_line(line) == BUILTIN_EXIT) {
+			break;
+		}
 	}
+	return last_status;
+}
 
-	// Builtin found
-	ret = BUILTIN_OK;
-
-	int stdout_dup, stdin_dup, out_fd, in_fd;
-	stdout_dup = stdin_dup = out_fd = in_fd = -1;
-
-	// Setup redirects if they exist
+int main(int argc, char** argv) {
+#ifdef RUNTESTS
+	parser_tests();
+	return 0;
+#endif
 
-	if (cmd->in_file || (pipefd[0] >= 0 && pipefd[1] != STDIN_FILENO)) {
-		// We're redirecting stdin somewhere, so save the old one
-		if ((stdin_dup = dup(STDIN_FILENO)) < 0) {
-			perror("builtin: Failed to store stdin fd");
-			ret = BUILTIN_ERROR;
+	FILE* script = NULL;
+	char* commands = NULL;
+	if (argc > 1 && strcmp(argv[1], "-c") == 0) {
+		if (argc < 3) {
+			fprintf(stderr, "%s: -c: option requires an argument\n", argv[0]);
+			return 2;
 		}
-	}
-	if (cmd->in_file) { // We're redirecting to a file
-		if ((in_fd = open(cmd->in_file, O_RDONLY)) < 0) {
-			perror("builtin: Failed to open input file");
-			ret = BUILTIN_ERROR;
+		commands = argv[2];
+	} else if (argc > 1) {
+		if ((script = fopen(argv[1], "r")) == NULL) {
+			perror(argv[1]);
+			return 127;
 		}
-	} else if (pipefd[0] != STDIN_FILENO) { // We're rediricting to a pipe
-		in_fd = pipefd[0];
-	}
-	if (in_fd >= 0 && dup2(in_fd, STDIN_FILENO) < 0) { // Do the redirection
-		perror("builtin: Failed to redirect stdin");
-		ret = BUILTIN_ERROR;
+	} else if (!isatty(STDIN_FILENO)) {
+		// Being fed from a file or pipe, treat it as a script
+		script = stdin;
 	}
 
-	if (ret == BUILTIN_OK) {
-	if (cmd->out_file || (pipefd[1] >= 0 && pipefd[1] != STDOUT_FILENO)) {
-		// We're redirecting stdout somewhere, so save the old one
-		if ((stdout_dup = dup(STDOUT_FILENO)) < 0) {
-			perror("builtin: Failed to store stdout fd");
-			ret = BUILTIN_ERROR;
-		}
-	}
-	if (cmd->out_file) { // We're redirecting to a file
-		if ((out_fd = open(cmd->out_file, O_WRONLY|O_CREAT|O_TRUNC, 0666)) < 0) {
-			perror("builtin: Failed to open output file");
-			ret = BUILTIN_ERROR;
-		}
-	} else if (pipefd[1] != STDOUT_FILENO) { // We're rediricting to a pipe
-		out_fd = pipefd[1];
-	}
-	if (out_fd >= 0 && dup2(out_fd, STDOUT_FILENO) < 0) { // Do the redirection
-		perror("builtin: Failed to redirect stdout");
-		ret = BUILTIN_ERROR;
+	// Initialize shell by ignoring certain job control signals
+	signal(SIGTSTP, SIG_IGN);
+	signal(SIGTTIN, SIG_IGN);
+	signal(SIGTTOU, SIG_IGN);
+
+	pipeline_pgid = 0;
+	last_status = 0;
+	jobs_init(!commands && !script);
+	if (var_get("SHELL_ZYGOTE")) {
+		zygote_start();
 	}
+	trace_changed();
+	pipe_size_changed();
+	arena_init(&line_arena, LINE_ARENA_SIZE);
+
+	if (commands) {
+		return run_string(commands);
+	} else if (script) {
+		return run_script(script);
 	}
 
-	// Execute the builtin
-	if (ret == BUILTIN_OK) {
-		ret = (*(builtins[builtin_idx].func))(cmd);
+	// Use sigaction because on Paris the handler is uninstalled for some reason
+	// after being triggered once
+	struct sigaction action;
+	memset(&action, 0, sizeof(sigaction));
+	action.sa_handler = handle_sigint;
+	if (sigaction(SIGINT, &action, NULL) < 0) {
+		perror("Failed to setup signal handler");
 	}
+	history_init();
+	rl_bind_key(CTRL('r'), reverse_search);
+	rl_attempted_completion_function = complete_line;
 
-	// Reset stdout and stdin back to what they were
-	if (cmd->out_file) {
-		if (out_fd >= 0 && close(out_fd) < 0) {
-			perror("builtin: Failed to close output file");
-			ret = BUILTIN_ERROR;
-		}
-	}
-	if (stdout_dup >= 0) {
-		// Reset stdout
-		if (dup2(stdout_dup, STDOUT_FILENO) < 0) {
-			perror("builtin: Failed to reset stdout");
-			ret = BUILTIN_ERROR;
-		}
-		if (close(stdout_dup) < 0) {
-			// There's literally nothing we can do here... it's kind of pointless
-			// to actually check if it's successful or not. If it's not, there's
-			// something seriously wrong.
-			perror("builtin: Failed to close stored stdout fd");
-			ret = BUILTIN_ERROR;
-		}
-	}
-	if (cmd->in_file) {
-		if (in_fd >= 0 && close(in_fd) < 0) {
-			perror("builtin: Failed to close input file");
-			ret = BUILTIN_ERROR;
-		}
-	}
-	if (stdin_dup >= 0) {
-		// Reset stdin
-		if (dup2(stdin_dup, STDIN_FILENO) < 0) {
-			perror("builtin: Failed to reset stdin");
-			ret = BUILTIN_ERROR;
-		}
-		if (close(stdin_dup) < 0) {
-			perror("builtin: Failed to close stored stdin fd");
-			ret = BUILTIN_ERROR;
-		}
-	}
-	return ret;
-}
+	char* s;
 
-status_t execute_external(struct command_t* cmd) {
-	status_t ret = EXTERNAL_OK;
-	int out_fd, in_fd;
-	out_fd = in_fd = -1;
-	if (cmd->out_file) {
-		if ((out_fd = open(cmd->out_file, O_WRONLY|O_CREAT|O_TRUNC, 0666)) < 0) {
-			perror("external: Failed to open output file");
-			ret = EXTERNAL_ERROR;
-		} else if (dup2(out_fd, STDOUT_FILENO) < 0) {
-			perror("external: Failed to redirect stdout");
-			ret = EXTERNAL_ERROR;
+	while (1) {
+		// Say which background jobs finished while we were busy
+		jobs_notify(0);
+		if ((s = readline(prompt_get())) == NULL) {
+			break;
 		}
-	}
-	if (cmd->in_file) {
-		if ((in_fd = open(cmd->in_file, O_RDONLY)) < 0) {
-			perror("external: Failed to open input file");
-			ret = EXTERNAL_ERROR;
-		} else if (dup2(in_fd, STDIN_FILENO) < 0) {
-			perror("external: Failed to redirect stdin");
-			ret = EXTERNAL_ERROR;
+
+		add_history(s);
+		histdb_add(s);
+
+		// EXIT is the only return we really care about, errors
+		// have already been taken care of
+		if (run_line(s) == BUILTIN_EXIT) {
+			break;
 		}
-	}
-	if (ret == EXTERNAL_OK) {
-		execvp(cmd->argv[0], cmd->argv);
-		// We failed to execute!
-		perror(cmd->argv[0]);
-	}
 
-	// Close our files, I guess. Kind of pointless
-	// since we're about to exit and they'll be
-	// force closed anyway
-	if (out_fd >= 0 && close(out_fd) < 0) {
-		perror("external: Failed to close output file");
-	}
-	if (in_fd >= 0 && close(in_fd) < 0) {
-		perror("external: Failed to close input file");
+		free(s);
+
 	}
-	exit(1);
+	// s will be NULL on ctrl-d with no buffer, but
+	// that's okay because then free does nothing
+	free(s);
+	return last_status;
 }
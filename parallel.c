@@ -0,0 +1,289 @@
+/**
+ * @file parallel.c
+ *
+ * The parallel builtin: runs a command once per input, keeping up to one
+ * copy per core going at a time.
+ *
+ * Each copy's stdout goes to its own temporary file, which is copied to our
+ * stdout in one piece when it finishes, so the output of different copies
+ * never gets interleaved.
+ */
+
+#include "builtins.h"
+#include "execute.h"
+#include "jobs.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#define PARALLEL_COPY_SIZE (1 << 16)
+#define PARALLEL_MAX_STATUS 101 // Same cap GNU parallel puts on its failure count
+#define PARALLEL_MAX_JOBS 1024 // Each copy holds a process and an open file
+
+struct parallel_slot_t {
+	struct command_t cmd;
+	struct job_t* job; // NULL when the slot is free
+	FILE* out;
+};
+
+/**
+ * Fill in a copy of the template for one input. Every {} in the template is
+ * replaced with the input, or if there aren't any it's added on the end.
+ * @param cmd Command to fill in, argv is a single allocation
+ * @param tmpl Template arguments
+ * @param tmpl_argc Number of template arguments
+ * @param input Input to substitute
+ */
+static void expand(struct command_t* cmd, char** tmpl, size_t tmpl_argc, const char* input) {
+	size_t input_len = strlen(input);
+	size_t size = 0;
+	int replaced = 0;
+	for (size_t i = 0; i < tmpl_argc; i++) {
+		size += strlen(tmpl[i]) + 1;
+		for (const char* p = tmpl[i]; (p = strstr(p, "{}")); p += 2) {
+			size += input_len - 2;
+			replaced = 1;
+		}
+	}
+	size_t argc = tmpl_argc;
+	if (!replaced) {
+		size += input_len + 1;
+		argc++;
+	}
+
+	memset(cmd, 0, sizeof(struct command_t));
+	cmd->argv = (char**)malloc(sizeof(char*) * (argc + 1) + size);
+	cmd->argc = cmd->argc_max = argc;
+	char* w = (char*)(cmd->argv + argc + 1);
+	for (size_t i = 0; i < tmpl_argc; i++) {
+		cmd->argv[i] = w;
+		const char* r = tmpl[i];
+		const char* p;
+		while ((p = strstr(r, "{}"))) {
+			memcpy(w, r, p - r);
+			w += p - r;
+			memcpy(w, input, input_len);
+			w += input_len;
+			r = p + 2;
+		}
+		w = stpcpy(w, r) + 1;
+	}
+	if (!replaced) {
+		cmd->argv[tmpl_argc] = w;
+		strcpy(w, input);
+	}
+	cmd->argv[argc] = NULL;
+	cmd->builtin = find_builtin(cmd->argv[0]);
+}
+
+/**
+ * Start one copy of the command
+ * @param slot Slot holding the expanded command
+ * @param in_fd What the copy reads from
+ * @return 0 on success, -1 if it couldn't be started
+ */
+static int launch(struct parallel_slot_t* slot, int in_fd) {
+	if ((slot->out = tmpfile()) == NULL) {
+		perror("parallel: Failed to create output file");
+		return -1;
+	}
+	// Only the copy it belongs to should have it open
+	fcntl(fileno(slot->out), F_SETFD, FD_CLOEXEC);
+
+	// Copies run in our process group, so ^C reaches them like it would a
+	// foreground job
+	int fd[2] = {in_fd, fileno(slot->out)};
+	pid_t pid = execute_command_child(&slot->cmd, fd, getpgrp());
+	if (pid < 0) {
+		fclose(slot->out);
+		slot->out = NULL;
+		return -1;
+	}
+
+	slot->job = job_new(&slot->cmd, 0);
+	struct limits_t limits;
+	job_add(slot->job, pid, slot->cmd.argv[0], execute_limits(&slot->cmd, &limits));
+	slot->job->pgid = getpgrp();
+	return 0;
+}
+
+/**
+ * Pass on a finished copy's output and free its slot
+ * @return The copy's exit status
+ */
+static int finish(struct parallel_slot_t* slot) {
+	int status = job_status(slot->job);
+	job_free(slot->job);
+	slot->job = NULL;
+
+	char buf[PARALLEL_COPY_SIZE];
+	size_t n;
+	rewind(slot->out);
+	while ((n = fread(buf, 1, sizeof(buf), slot->out)) > 0) {
+		fwrite(buf, 1, n, stdout);
+	}
+	fflush(stdout);
+	fclose(slot->out);
+	slot->out = NULL;
+
+	free(slot->cmd.argv);
+	slot->cmd.argv = NULL;
+	return status;
+}
+
+status_t builtin_parallel(struct command_t* cmd) {
+	long max_jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t first = 1;
+	if (cmd->argc > 2 && strcmp(cmd->argv[1], "-j") == 0) {
+		char* end;
+		max_jobs = strtol(cmd->argv[2], &end, 10);
+		if (*end != '\0' || max_jobs < 1) {
+			printf("parallel: -j needs a positive number\n");
+			return BUILTIN_ERROR;
+		}
+		first = 3;
+	}
+
+	// Template runs up to :::, the inputs are after it or on stdin
+	size_t sep = first;
+	while (sep < cmd->argc && strcmp(cmd->argv[sep], ":::") != 0) {
+		sep++;
+	}
+	if (sep == first) {
+		printf("Error: Usage: parallel [-j jobs] command [arg ...] [::: input ...]\n");
+		return BUILTIN_ERROR;
+	}
+
+	// No point having more slots than copies that can ever run at once
+	if (sep < cmd->argc && max_jobs > (long)(cmd->argc - sep - 1)) {
+		max_jobs = cmd->argc - sep - 1;
+	}
+	if (max_jobs > PARALLEL_MAX_JOBS) {
+		max_jobs = PARALLEL_MAX_JOBS;
+	}
+	if (max_jobs < 1) {
+		max_jobs = 1;
+	}
+
+	FILE* input = NULL;
+	size_t next_arg = sep + 1;
+	int in_fd = STDIN_FILENO;
+	if (sep == cmd->argc) {
+		// Read from the fd itself, stdin's buffer may hold someone else's data
+		int dup_fd = dup(STDIN_FILENO);
+		if (dup_fd < 0 || (input = fdopen(dup_fd, "r")) == NULL) {
+			perror("parallel: Failed to read stdin");
+			return BUILTIN_ERROR;
+		}
+		// The copies mustn't eat our inputs
+		if ((in_fd = open("/dev/null", O_RDONLY | O_CLOEXEC)) < 0) {
+			perror("parallel: Failed to open /dev/null");
+			fclose(input);
+			return BUILTIN_ERROR;
+		}
+	}
+
+	// Same as execute_command, the copies have to be in the job table
+	// before the SIGCHLD handler can reap them
+	struct parallel_slot_t* slots = (struct parallel_slot_t*)calloc(max_jobs, sizeof(struct parallel_slot_t));
+	if (slots == NULL) {
+		perror("parallel: Failed to allocate job slots");
+		if (input) {
+			fclose(input);
+			close(in_fd);
+		}
+		return BUILTIN_ERROR;
+	}
+	sigset_t mask, old_mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &mask, &old_mask);
+
+	char* line = NULL;
+	size_t line_size = 0;
+	long running = 0;
+	size_t total = 0;
+	size_t failed = 0;
+	int more = 1;
+	long free_slot = 0;
+
+	while (more || running > 0) {
+		// Top up the running copies
+		while (more && running < max_jobs) {
+			const char* arg = NULL;
+			if (input) {
+				ssize_t len = getline(&line, &line_size, input);
+				if (len >= 0) {
+					if (len > 0 && line[len - 1] == '\n') {
+						line[len - 1] = '\0';
+					}
+					arg = line;
+				}
+			} else if (next_arg < cmd->argc) {
+				arg = cmd->argv[next_arg++];
+			}
+			if (arg == NULL) {
+				more = 0;
+				break;
+			}
+
+			while (slots[free_slot].job) {
+				free_slot = (free_slot + 1) % max_jobs;
+			}
+			struct parallel_slot_t* slot = &slots[free_slot];
+			expand(&slot->cmd, cmd->argv + first, sep - first, arg);
+			total++;
+			if (launch(slot, in_fd) < 0) {
+				failed++;
+				free(slot->cmd.argv);
+				slot->cmd.argv = NULL;
+			} else {
+				running++;
+			}
+		}
+		if (running == 0) {
+			break;
+		}
+
+		jobs_wait_change();
+		for (long i = 0; i < max_jobs; i++) {
+			struct job_t* job = slots[i].job;
+			if (job == NULL) {
+				continue;
+			}
+			enum job_state_t state = job_state(job);
+			if (state == kJobStopped) {
+				// Nobody could fg it, so don't let it be stopped
+				kill(job->procs[0].pid, SIGCONT);
+			} else if (state == kJobDone) {
+				int status = job->procs[0].status;
+				if (WIFSIGNALED(status) && WTERMSIG(status) == SIGINT) {
+					// ^C, don't start anything else
+					more = 0;
+				}
+				if (finish(&slots[i]) != 0) {
+					failed++;
+				}
+				running--;
+			}
+		}
+	}
+
+	sigprocmask(SIG_SETMASK, &old_mask, NULL);
+	free(slots);
+	free(line);
+	if (input) {
+		fclose(input);
+		close(in_fd);
+	}
+
+	if (failed > 0) {
+		printf("parallel: %zu of %zu jobs failed\n", failed, total);
+	}
+	builtin_status = failed < PARALLEL_MAX_STATUS ? failed : PARALLEL_MAX_STATUS;
+	return BUILTIN_OK;
+}
@@ -6,25 +6,269 @@
 
 #include "parser.h"
 #include "utility.h"
+#include "builtins.h"
+#include "scan.h"
+#include "vars.h"
+#include "execute.h"
+#include "pathglob.h"
+#include "rlimits.h"
+#include "cmdcache.h"
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 #include <assert.h>
 
 #include <stdio.h>
 
 /**
- * Create a new command "object"
+ * Create a new command "object". It's freed along with everything else in
+ * the arena, so there's no delete.
+ * @param arena Arena to allocate the command from
  * @return The new command object
  */
-struct command_t* new_command() {
-	struct command_t* cmd = (struct command_t*)malloc(sizeof(struct command_t));
+struct command_t* new_command(struct arena_t* arena) {
+	struct command_t* cmd = (struct command_t*)arena_alloc(arena, sizeof(struct command_t));
 	memset(cmd, 0, sizeof(struct command_t));
+	cmd->arena = arena;
 	cmd->argc_max = 256; // Initial max size
-	cmd->argv = (char**)malloc(sizeof(char*) * cmd->argc_max);
+	cmd->argv = (char**)arena_alloc(arena, sizeof(char*) * cmd->argc_max);
 	cmd->argv[0] = NULL; // Only need to set the first one
 	return cmd;
 }
 
+// Characters that end a plain run of text in each kind of section
+#define UNQUOTED_SPECIAL " \"'<>|&\\$*?["
+#define DOUBLE_QUOTED_SPECIAL "\"\\$"
+#define SINGLE_QUOTED_SPECIAL "'\\"
+
+/**
+ * Move a run of plain characters from where we're reading to where we're
+ * writing. They're often the same place, in which case there's nothing to do.
+ * @param write_pos Where to write the run
+ * @param read_pos Start of the run
+ * @param end End of the run
+ * @return New write position
+ */
+static char* copy_run(char* write_pos, const char* read_pos, const char* end) {
+	size_t len = end - read_pos;
+	if (write_pos != read_pos) {
+		memmove(write_pos, read_pos, len);
+	}
+	return write_pos + len;
+}
+
+// Where expand() can write, once expansions have outgrown the input
+struct expand_state_t {
+	const char* str_end; // End of the input, found the first time we need it
+	char* write_end;     // End of the arena buffer we're writing to, NULL while still writing over the input
+};
+
+static int is_name_start(char c) {
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+static int is_name_char(char c) {
+	return is_name_start(c) || (c >= '0' && c <= '9');
+}
+
+/**
+ * Expand the $ we're reading: $NAME, ${NAME}, $? or $$. A $ that doesn't
+ * start any of those is just a $.
+ *
+ * Values are written over the input like everything else, as long as they
+ * fit in the space the reference took up. When one doesn't, the argument so
+ * far moves to the arena, with room for the value and the rest of the line,
+ * and writing carries on there.
+ * @return kBadSubstitution for a ${ without a name and }, else kParseOK
+ */
+static enum parse_error_t expand(struct arena_t* arena, struct expand_state_t* state,
+		char** read_pos, char** write_pos, char** arg) {
+	const char* r = *read_pos + 1;
+	const char* value;
+	size_t value_len;
+	char number[24];
+	if (*r == '?' || *r == '$') {
+		value_len = sprintf(number, "%d", *r == '?' ? last_status : (int)getpid());
+		value = number;
+		r++;
+	} else if (*r == '{') {
+		const char* name = ++r;
+		while (is_name_char(*r)) {
+			r++;
+		}
+		if (*r != '}' || r == name || !is_name_start(*name)) {
+			return kBadSubstitution;
+		}
+		value = var_getn(name, r - name);
+		value_len = value ? strlen(value) : 0;
+		r++;
+	} else if (is_name_start(*r)) {
+		const char* name = r;
+		while (is_name_char(*r)) {
+			r++;
+		}
+		value = var_getn(name, r - name);
+		value_len = value ? strlen(value) : 0;
+	} else {
+		*read_pos = (char*)r;
+		*(*write_pos)++ = '$';
+		return kParseOK;
+	}
+	*read_pos = (char*)r;
+
+	// Leave room for the rest of the line, which never gets longer unless
+	// it has expansions of its own
+	const char* limit = state->write_end ? state->write_end - (state->str_end - r) - 1 : r;
+	if (*write_pos + value_len > limit) {
+		if (state->str_end == NULL) {
+			state->str_end = r + strlen(r);
+		}
+		size_t arg_len = *write_pos - *arg;
+		size_t size = 2 * (arg_len + value_len + (state->str_end - r) + 1);
+		char* buf = (char*)arena_alloc(arena, size);
+		memcpy(buf, *arg, arg_len);
+		*arg = buf;
+		*write_pos = buf + arg_len;
+		state->write_end = buf + size;
+	}
+	memcpy(*write_pos, value, value_len);
+	*write_pos += value_len;
+	return kParseOK;
+}
+
+static size_t count_glob_chars(const char* str, size_t len) {
+	size_t count = 0;
+	for (size_t i = 0; i < len; i++) {
+		count += str[i] == '*' || str[i] == '?' || str[i] == '[';
+	}
+	return count;
+}
+
+/**
+ * Add a finished argument, or the paths it matches if it's a pattern
+ * @param len Length of the argument, which isn't NUL terminated yet
+ * @param glob_chars How many unquoted *, ? and [ it had. It's only a
+ *                   pattern if none were quoted, escaped or expanded.
+ * @param glob_cache Directories read for earlier patterns in the line
+ */
+static enum parse_error_t add_word(struct command_t* cmd, char* arg, size_t len, enum parse_token_t token_type,
+		size_t glob_chars, struct pathglob_cache_t* glob_cache) {
+	if (token_type == kArgument && glob_chars > 0 && count_glob_chars(arg, len) == glob_chars) {
+		char* pattern = (char*)arena_alloc(cmd->arena, len + 1);
+		memcpy(pattern, arg, len);
+		pattern[len] = '\0';
+		char** matches;
+		size_t count = pathglob(glob_cache, pattern, &matches);
+		for (size_t i = 0; i < count; i++) {
+			add_arg(cmd, matches[i], kArgument);
+		}
+		free(matches);
+		if (count > 0) {
+			return kParseOK;
+		}
+		// Nothing matched, so it's left as it is like in sh
+	}
+	return add_arg(cmd, arg, token_type);
+}
+
+/**
+ * Recognize a limit prefix, e.g. the limit -t 10 of limit -t 10 make
+ * @param argv Words to look at, NULL terminated
+ * @param limits Where to put the limits it sets, or NULL
+ * @return How many words the prefix takes up, 0 if there isn't one
+ */
+int limit_prefix(char** argv, struct limits_t* limits) {
+	if (argv[0] == NULL || strcmp(argv[0], "limit") != 0) {
+		return 0;
+	}
+	struct limits_t parsed;
+	memset(&parsed, 0, sizeof(parsed));
+	// Bad options are the builtin's to complain about
+	int used = limits_parse(&parsed, argv + 1, 0);
+	if (used < 0) {
+		return 0;
+	}
+	if (limits) {
+		*limits = parsed;
+	}
+	return 1 + used;
+}
+
+/**
+ * Recognize a timeout prefix, e.g. the timeout 10 of timeout 10 make.
+ * Anything that doesn't start with a number of seconds, like timeout(1)
+ * with options, isn't one.
+ * @param argv Words to look at, NULL terminated
+ * @param seconds Where to put the timeout, or NULL
+ * @return How many words the prefix takes up, 0 if there isn't one
+ */
+int timeout_prefix(char** argv, double* seconds) {
+	if (argv[0] == NULL || strcmp(argv[0], "timeout") != 0 || argv[1] == NULL) {
+		return 0;
+	}
+	char* end;
+	double parsed = strtod(argv[1], &end);
+	if (end == argv[1] || *end != '\0' || !(parsed > 0)) {
+		return 0;
+	}
+	if (seconds) {
+		*seconds = parsed;
+	}
+	return 2;
+}
+
+/**
+ * Count the prefixes at the start of a stage, so completion knows where
+ * its command goes the same way parse() does
+ * @param argv Stage's words, NULL terminated
+ * @param first Whether it's the first stage, the only one time and timeout go on
+ * @return How many words are prefixes
+ */
+int prefix_words(char** argv, int first) {
+	int i = 0;
+	if (first) {
+		if (argv[i] && strcmp(argv[i], "time") == 0) {
+			i++;
+		}
+		i += timeout_prefix(argv + i, NULL);
+	}
+	return i + limit_prefix(argv + i, NULL);
+}
+
+/**
+ * Take a limit prefix off a command. limit with nothing after its options
+ * is left alone, since that's the builtin.
+ */
+static void strip_limit(struct command_t* cmd) {
+	struct limits_t limits;
+	int used = limit_prefix(cmd->argv, &limits);
+	if (used == 0 || used >= cmd->argc) {
+		return;
+	}
+	if (limits.set) {
+		cmd->limits = (struct limits_t*)arena_alloc(cmd->arena, sizeof(struct limits_t));
+		*cmd->limits = limits;
+	}
+	memmove(cmd->argv, cmd->argv + used, sizeof(char*) * (cmd->argc - used + 1)); // Brings the NULL along
+	cmd->argc -= used;
+}
+
+/**
+ * Take a timeout prefix off a pipeline, as long as there's a command after it
+ */
+static void strip_timeout(struct command_t* cmd) {
+	double seconds;
+	int used = timeout_prefix(cmd->argv, &seconds);
+	if (used == 0 || used >= cmd->argc) {
+		return;
+	}
+	cmd->timeout = seconds;
+	memmove(cmd->argv, cmd->argv + used, sizeof(char*) * (cmd->argc - used + 1)); // Brings the NULL along
+	cmd->argc -= used;
+}
+
 /**
  * Parse a string and store the results into the provided command object
  * @param cmd Command object
@@ -42,6 +286,10 @@ enum parse_error_t parse(struct command_t* cmd, char* str) {
 	char* write_pos = str; // Used for escape sequences
 
 	char* arg = NULL;
+	int quoted = 0; // Whether arg had quotes, which keep it even if it's empty
+	size_t glob_chars = 0; // Unquoted *, ? and [ in arg
+	struct expand_state_t expand_state = {NULL, NULL};
+	struct pathglob_cache_t glob_cache = {cmd->arena, NULL, 0};
 
 	enum parse_token_t token_type = kArgument;
 
@@ -49,10 +297,10 @@ enum parse_error_t parse(struct command_t* cmd, char* str) {
 
 	while(*read_pos) {
 
-		if (arg && *arg != '\0' && (*read_pos == ' ' || *read_pos == '<' || *read_pos == '>' || *read_pos == '|')) {
+		if (arg && (write_pos != arg || quoted) && (*read_pos == ' ' || *read_pos == '<' || *read_pos == '>' || *read_pos == '|' || *read_pos == '&')) {
 			// We're at a delimiter and we were just parsing an argument
 			// so add it to the command
-			int ret = add_arg(working_cmd, arg, token_type);
+			int ret = add_word(working_cmd, arg, write_pos - arg, token_type, glob_chars, &glob_cache);
 			if (ret != kParseOK) {
 				return ret;
 			}
@@ -76,10 +324,22 @@ enum parse_error_t parse(struct command_t* cmd, char* str) {
 				// End of input while expecting the pipe to go somewhere
 				return kUnexpectedEnd;
 			}
-			working_cmd->pipe = new_command();
+			working_cmd->pipe = new_command(working_cmd->arena);
 			working_cmd = working_cmd->pipe;
 			token_type = kArgument;
 			continue;
+		} else if (*read_pos == '&') {
+			// Run in the background, which has to be the last thing on the line
+			if (working_cmd->argc == 0) {
+				return kNoArgs;
+			}
+			while (*(++read_pos) == ' ') {} // Eat spaces
+			if (*read_pos) {
+				return kBackgroundNotLast;
+			}
+			cmd->background = 1;
+			arg = NULL;
+			continue;
 		} else if (*read_pos && !arg && token_type != kArgument) {
 			// We're starting a normal section after we've had a redirect
 			return kArgumentAfterRedirect;
@@ -91,30 +351,48 @@ enum parse_error_t parse(struct command_t* cmd, char* str) {
 				write_pos++;
 			}
 			arg = write_pos;
+			quoted = 0;
+			glob_chars = 0;
 		}
 
 		if (*read_pos == '"' || *read_pos == '\'') {
 			// We're arging a quoted section
 			char quote = *read_pos;
+			quoted = 1;
+			const char* special = quote == '"' ? DOUBLE_QUOTED_SPECIAL : SINGLE_QUOTED_SPECIAL;
 			read_pos++;
 			while (*read_pos) {
+				// Copy everything up to the next backslash or quote in one go
+				char* next = (char*)scan_for(read_pos, special);
+				write_pos = copy_run(write_pos, read_pos, next);
+				read_pos = next;
+
 				if (*read_pos == '\\') { // Escape sequence
 					read_pos++;
 					if (!*read_pos) {
 						// Reached end of input while in an escape sequence
 						return kUnexpectedEnd;
 					}
-					// Check if we're trying to escape a backslash or quote
-					if (!(*read_pos == '\\' || *read_pos == quote)) {
+					// Check if we're trying to escape a backslash, quote or $
+					if (!(*read_pos == '\\' || *read_pos == quote || (quote == '"' && *read_pos == '$'))) {
 						// If we're in invalid escape, then we just write the backslash out too
 						*write_pos = '\\';
 						write_pos++;
 					} // Else we skip over the backslash
+				} else if (*read_pos == '$') {
+					// Only double quotes stop here
+					int ret = expand(cmd->arena, &expand_state, &read_pos, &write_pos, &arg);
+					if (ret != kParseOK) {
+						return ret;
+					}
+					continue;
 				} else if (*read_pos == quote) {
 					// We're at the end of the quoted section
 					quote = '\0';
 					read_pos++;
 					break;
+				} else {
+					break; // End of input
 				}
 				*write_pos = *read_pos;
 				read_pos++;
@@ -125,21 +403,42 @@ enum parse_error_t parse(struct command_t* cmd, char* str) {
 				return kUnexpectedEnd;
 			}
 		} else if (*read_pos) { // Start of normal section
-			while (*read_pos && *read_pos != ' ' && *read_pos != '"' && *read_pos != '\'' && *read_pos != '<' && *read_pos != '>' && *read_pos != '|') {
-				if (*read_pos == '\\') { // Escape sequence in nonquoted section
-					read_pos++;
-					if (!*read_pos) {
-						// Reached end of input while in an escape sequence
-						return kUnexpectedEnd;
+			while (1) {
+				// Copy everything up to the next special character in one go
+				char* next = (char*)scan_for(read_pos, UNQUOTED_SPECIAL);
+				write_pos = copy_run(write_pos, read_pos, next);
+				read_pos = next;
+
+				if (*read_pos == '$') {
+					int ret = expand(cmd->arena, &expand_state, &read_pos, &write_pos, &arg);
+					if (ret != kParseOK) {
+						return ret;
 					}
-					if (!(*read_pos == '\\' || *read_pos == ' ' || *read_pos == '"' || *read_pos == '\'' || *read_pos == '|')) {
-						// If we're in invalid escape, then we just write the backslash out too
-						// This is technically different than bash, which for some reason just
-						// drops it unless in a quoted
-						*write_pos = '\\';
-						write_pos++;
-					} // Else we skip over the backslash
+					continue;
+				}
+				if (*read_pos == '*' || *read_pos == '?' || *read_pos == '[') {
+					glob_chars++;
+					*write_pos++ = *read_pos++;
+					continue;
+				}
+				if (*read_pos != '\\') {
+					// Reached a delimiter, quote or the end
+					break;
 				}
+				// Escape sequence in nonquoted section
+				read_pos++;
+				if (!*read_pos) {
+					// Reached end of input while in an escape sequence
+					return kUnexpectedEnd;
+				}
+				if (!(*read_pos == '\\' || *read_pos == ' ' || *read_pos == '"' || *read_pos == '\'' || *read_pos == '|' || *read_pos == '&' ||
+						*read_pos == '$' || *read_pos == '*' || *read_pos == '?' || *read_pos == '[')) {
+					// If we're in invalid escape, then we just write the backslash out too
+					// This is technically different than bash, which for some reason just
+					// drops it unless in a quoted
+					*write_pos = '\\';
+					write_pos++;
+				} // Else we skip over the backslash
 				*write_pos = *read_pos;
 				read_pos++;
 				write_pos++;
@@ -149,29 +448,36 @@ enum parse_error_t parse(struct command_t* cmd, char* str) {
 	}
 	*write_pos = '\0';
 
-	if (arg && *arg != '\0') {
+	if (arg && (write_pos != arg || quoted)) {
 		// This pretty much means we didn't end on a space, so we need to add the argument
-		int ret = add_arg(working_cmd, arg, token_type);
+		int ret = add_word(working_cmd, arg, write_pos - arg, token_type, glob_chars, &glob_cache);
 		if (ret != kParseOK) {
 			return ret;
 		}
 	}
 
-	return kParseOK;
-}
-
-/**
- * Free the memory used by the command object
- * @param cmd Command object
- */
-void delete_command(struct command_t* cmd) {
-	if (cmd) {
-		if (cmd->pipe) {
-			delete_command(cmd->pipe);
+	// A leading time is for the whole pipeline, it isn't the command
+	if (cmd->argc > 0 && strcmp(cmd->argv[0], "time") == 0) {
+		memmove(cmd->argv, cmd->argv + 1, sizeof(char*) * cmd->argc); // Brings the NULL along
+		cmd->argc--;
+		cmd->timed = 1;
+		if (cmd->argc == 0) {
+			return kNoArgs;
 		}
-		free(cmd->argv);
-		free(cmd);
 	}
+	strip_timeout(cmd);
+	if (cmd->timeout > 0 && cmd->background) {
+		// Timeouts are only enforced while we wait for the job
+		return kTimeoutInBackground;
+	}
+
+	// Look builtins up once now rather than every time we need to know
+	for (working_cmd = cmd; working_cmd; working_cmd = working_cmd->pipe) {
+		strip_limit(working_cmd);
+		working_cmd->builtin = working_cmd->argc ? find_builtin(working_cmd->argv[0]) : NULL;
+	}
+
+	return kParseOK;
 }
 
 /**
@@ -187,12 +493,9 @@ enum parse_error_t add_arg(struct command_t* cmd, char* arg, enum parse_token_t
 
 		if (cmd->argc == cmd->argc_max) {
 			cmd->argc_max *= 2;
-			char** tmp = (char**)malloc(sizeof(char*) * cmd->argc_max);
-			// Copy current list over
-			for (int i = 0; i < cmd->argc; i++) {
-				tmp[i] = cmd->argv[i];
-			}
-			free(cmd->argv);
+			char** tmp = (char**)arena_alloc(cmd->arena, sizeof(char*) * cmd->argc_max);
+			// Copy current list over, the old one goes when the arena is reset
+			memcpy(tmp, cmd->argv, sizeof(char*) * cmd->argc);
 			cmd->argv = tmp;
 		}
 
@@ -254,13 +557,12 @@ void dump_ascii(char* str, size_t len) {
 	printf("\n");
 }
 
-/**
- * Run parser tests
- */
-int parser_tests() {
+static void run_parser_tests() {
 	char buf[768];
 	memset(buf, 0, 768);
-	struct command_t* cmd = new_command();
+	struct arena_t arena;
+	arena_init(&arena, 4096);
+	struct command_t* cmd = new_command(&arena);
 
 	// Check being given a zero length string
 	assert(parse(cmd, buf) == kParseOK);
@@ -424,7 +726,7 @@ int parser_tests() {
 	// No spaces pipe
 	strcpy(buf, "foo|bar");
 	cmd->argc = 0;
-	delete_command(cmd->pipe); cmd->pipe = NULL;
+	cmd->pipe = NULL;
 	cmd->out_file = cmd->in_file = NULL;
 	assert(parse(cmd, buf) == kParseOK);
 	assert(strcmp(cmd->argv[0], "foo") == 0);
@@ -434,21 +736,21 @@ int parser_tests() {
 	// Pipe to nowhere
 	strcpy(buf, "foo|");
 	cmd->argc = 0;
-	delete_command(cmd->pipe); cmd->pipe = NULL;
+	cmd->pipe = NULL;
 	cmd->out_file = cmd->in_file = NULL;
 	assert(parse(cmd, buf) == kUnexpectedEnd);
 
 	// Pipe to nowhere
 	strcpy(buf, "foo|");
 	cmd->argc = 0;
-	delete_command(cmd->pipe); cmd->pipe = NULL;
+	cmd->pipe = NULL;
 	cmd->out_file = cmd->in_file = NULL;
 	assert(parse(cmd, buf) == kUnexpectedEnd);
 
 	// Pipe with redirects
 	strcpy(buf, "foo < qux | bar > quux");
 	cmd->argc = 0;
-	delete_command(cmd->pipe); cmd->pipe = NULL;
+	cmd->pipe = NULL;
 	cmd->out_file = cmd->in_file = NULL;
 	assert(parse(cmd, buf) == kParseOK);
 	assert(strcmp(cmd->argv[0], "foo") == 0);
@@ -460,7 +762,7 @@ int parser_tests() {
 	// Multiple pipes
 	strcpy(buf, "foo < qux | bar | baz > quux");
 	cmd->argc = 0;
-	delete_command(cmd->pipe); cmd->pipe = NULL;
+	cmd->pipe = NULL;
 	cmd->out_file = cmd->in_file = NULL;
 	assert(parse(cmd, buf) == kParseOK);
 	assert(strcmp(cmd->argv[0], "foo") == 0);
@@ -471,7 +773,378 @@ int parser_tests() {
 	assert(strcmp(cmd->pipe->pipe->argv[0], "baz") == 0);
 	assert(cmd->pipe->pipe->out_file && strcmp(cmd->pipe->pipe->out_file, "quux") == 0);
 
+	// Builtins are resolved per stage
+	strcpy(buf, "cd foo | foo | exit");
+	cmd->argc = 0;
+	cmd->pipe = NULL;
+	cmd->out_file = cmd->in_file = NULL;
+	assert(parse(cmd, buf) == kParseOK);
+	assert(cmd->builtin && strcmp(cmd->builtin->name, "cd") == 0);
+	assert(cmd->pipe->builtin == NULL);
+	assert(cmd->pipe->pipe->builtin && strcmp(cmd->pipe->pipe->builtin->name, "exit") == 0);
+
+	// Background
+	strcpy(buf, "foo bar | baz > quux &");
+	cmd->argc = 0;
+	cmd->pipe = NULL;
+	cmd->out_file = cmd->in_file = NULL;
+	cmd->background = 0;
+	assert(parse(cmd, buf) == kParseOK);
+	assert(cmd->background);
+	assert(cmd->argc == 2 && strcmp(cmd->argv[1], "bar") == 0);
+	assert(cmd->pipe->out_file && strcmp(cmd->pipe->out_file, "quux") == 0);
+
+	// Background, no space
+	strcpy(buf, "foo&");
+	cmd->argc = 0;
+	cmd->pipe = NULL;
+	cmd->out_file = cmd->in_file = NULL;
+	cmd->background = 0;
+	assert(parse(cmd, buf) == kParseOK);
+	assert(cmd->background);
+	assert(cmd->argc == 1 && strcmp(cmd->argv[0], "foo") == 0);
+
+	// Background in the middle
+	strcpy(buf, "foo & bar");
+	cmd->argc = 0;
+	cmd->pipe = NULL;
+	cmd->out_file = cmd->in_file = NULL;
+	cmd->background = 0;
+	assert(parse(cmd, buf) == kBackgroundNotLast);
+
+	// Background with no command
+	strcpy(buf, "&");
+	cmd->argc = 0;
+	cmd->pipe = NULL;
+	cmd->out_file = cmd->in_file = NULL;
+	cmd->background = 0;
+	assert(parse(cmd, buf) == kNoArgs);
+
+	// Escaped ampersand
+	strcpy(buf, "foo\\& \"bar&\"");
+	cmd->argc = 0;
+	cmd->pipe = NULL;
+	cmd->out_file = cmd->in_file = NULL;
+	cmd->background = 0;
+	assert(parse(cmd, buf) == kParseOK);
+	assert(!cmd->background);
+	assert(strcmp(cmd->argv[0], "foo&") == 0);
+	assert(strcmp(cmd->argv[1], "bar&") == 0);
+
+	// Timed pipeline
+	strcpy(buf, "time cd foo | time");
+	cmd->argc = 0;
+	cmd->pipe = NULL;
+	cmd->out_file = cmd->in_file = NULL;
+	cmd->timed = 0;
+	assert(parse(cmd, buf) == kParseOK);
+	assert(cmd->timed);
+	assert(cmd->argc == 2 && strcmp(cmd->argv[0], "cd") == 0 && cmd->argv[2] == NULL);
+	assert(cmd->builtin && strcmp(cmd->builtin->name, "cd") == 0);
+	assert(cmd->pipe->argc == 1 && strcmp(cmd->pipe->argv[0], "time") == 0);
+
+	// Nothing to time
+	strcpy(buf, "time > foo");
+	cmd->argc = 0;
+	cmd->pipe = NULL;
+	cmd->out_file = cmd->in_file = NULL;
+	cmd->timed = 0;
+	assert(parse(cmd, buf) == kNoArgs);
+
+	// Limit prefixes, on each stage that has one
+	strcpy(buf, "time limit -t 5 -v 1M sort -n | limit -n 16 cat | limit -q 1 cat");
+	cmd->argc = 0;
+	cmd->pipe = NULL;
+	cmd->out_file = cmd->in_file = NULL;
+	cmd->timed = 0;
+	cmd->limits = NULL;
+	assert(parse(cmd, buf) == kParseOK);
+	assert(cmd->timed);
+	assert(cmd->argc == 2 && strcmp(cmd->argv[0], "sort") == 0 && cmd->argv[2] == NULL);
+	assert(cmd->limits && cmd->limits->set == (kLimitCpu | kLimitAs));
+	assert(cmd->limits->cpu == 5 && cmd->limits->as == 1 << 20);
+	assert(cmd->pipe->argc == 1 && strcmp(cmd->pipe->argv[0], "cat") == 0);
+	assert(cmd->pipe->limits && cmd->pipe->limits->set == kLimitNofile && cmd->pipe->limits->nofile == 16);
+	// A bad option is left for the builtin to complain about
+	assert(cmd->pipe->pipe->argc == 4 && cmd->pipe->pipe->builtin && cmd->pipe->pipe->limits == NULL);
+
+	// The parse cache hands back the same pipeline, in new memory
+	const char* cached_line = "time limit -t 5 -v 1M sort -n | limit -n 16 cat | limit -q 1 cat";
+	assert(cmdcache_cacheable(cached_line) && !cmdcache_cacheable("echo $HOME") && !cmdcache_cacheable("ls *.c"));
+	assert(cmdcache_lookup(cached_line, &arena) == NULL);
+	cmdcache_store(cached_line, cmd);
+	struct command_t* hit = cmdcache_lookup(cached_line, &arena);
+	assert(hit && hit != cmd && hit->timed && hit->argc == 2 && strcmp(hit->argv[1], "-n") == 0);
+	assert(hit->limits && hit->limits != cmd->limits && hit->limits->cpu == 5);
+	assert(hit->pipe->limits->nofile == 16 && hit->pipe->pipe->builtin == cmd->pipe->pipe->builtin);
+	assert(hit->pipe->pipe->argc == 4 && hit->pipe->pipe->argv[4] == NULL);
+	cmdcache_clear();
+	assert(cmdcache_lookup(cached_line, &arena) == NULL);
+	cmdcache_reset_counters();
+
+	// A size too big to shift into bytes is bad, not wrapped
+	strcpy(buf, "limit -v 99999999T cat");
+	cmd->argc = 0;
+	cmd->pipe = NULL;
+	cmd->timed = 0;
+	cmd->limits = NULL;
+	assert(parse(cmd, buf) == kParseOK);
+	assert(cmd->argc == 4 && cmd->builtin && cmd->limits == NULL);
+
+	// Just limit is the builtin
+	strcpy(buf, "limit -t unlimited");
+	cmd->argc = 0;
+	cmd->pipe = NULL;
+	cmd->out_file = cmd->in_file = NULL;
+	cmd->timed = 0;
+	cmd->limits = NULL;
+	assert(parse(cmd, buf) == kParseOK);
+	assert(cmd->argc == 3 && cmd->builtin && cmd->limits == NULL);
+
+	// A timeout prefix is for the whole pipeline, timeout(1) with options isn't one
+	strcpy(buf, "time timeout 2.5 sort | cat");
+	cmd->argc = 0;
+	cmd->pipe = NULL;
+	cmd->out_file = cmd->in_file = NULL;
+	cmd->timed = 0;
+	cmd->timeout = 0;
+	assert(parse(cmd, buf) == kParseOK);
+	assert(cmd->timed && cmd->timeout == 2.5);
+	assert(cmd->argc == 1 && strcmp(cmd->argv[0], "sort") == 0 && cmd->argv[1] == NULL);
+	assert(cmd->pipe->argc == 1 && cmd->pipe->timeout == 0);
+	strcpy(buf, "timeout -s KILL 5 sleep 9");
+	cmd->argc = 0;
+	cmd->pipe = NULL;
+	cmd->timed = 0;
+	cmd->timeout = 0;
+	assert(parse(cmd, buf) == kParseOK);
+	assert(cmd->timeout == 0 && cmd->argc == 6 && strcmp(cmd->argv[0], "timeout") == 0);
+	strcpy(buf, "timeout 1 sleep 4 &");
+	cmd->argc = 0;
+	cmd->pipe = NULL;
+	cmd->timeout = 0;
+	cmd->background = 0;
+	assert(parse(cmd, buf) == kTimeoutInBackground);
+	cmd->timeout = 0;
+	cmd->background = 0;
+
+	// Expansion, in place when the value fits where the reference was
+	var_set("PARSER_TEST", "foo", 0);
+	var_delete("PARSER_UNSET");
+	strcpy(buf, "echo $PARSER_TEST ${PARSER_TEST}bar \"x$PARSER_TEST y\" '$PARSER_TEST' \\$PARSER_TEST \"\\$PARSER_TEST\"");
+	cmd->argc = 0;
+	cmd->pipe = NULL;
+	cmd->out_file = cmd->in_file = NULL;
+	cmd->timed = 0;
+	assert(parse(cmd, buf) == kParseOK);
+	assert(cmd->argc == 7);
+	assert(strcmp(cmd->argv[1], "foo") == 0);
+	assert(strcmp(cmd->argv[2], "foobar") == 0);
+	assert(strcmp(cmd->argv[3], "xfoo y") == 0);
+	assert(strcmp(cmd->argv[4], "$PARSER_TEST") == 0);
+	assert(strcmp(cmd->argv[5], "$PARSER_TEST") == 0);
+	assert(strcmp(cmd->argv[6], "$PARSER_TEST") == 0);
+	assert(memcmp(buf, "echo\0foo\0foobar\0xfoo y\0", 23) == 0);
+
+	// Unset variables are empty, and a $ that isn't a reference stays
+	strcpy(buf, "echo a${PARSER_UNSET}b $PARSER_UNSET $ a$ \"$\" $1");
+	cmd->argc = 0;
+	assert(parse(cmd, buf) == kParseOK);
+	assert(cmd->argc == 6);
+	assert(strcmp(cmd->argv[1], "ab") == 0);
+	assert(strcmp(cmd->argv[2], "$") == 0);
+	assert(strcmp(cmd->argv[3], "a$") == 0);
+	assert(strcmp(cmd->argv[4], "$") == 0);
+	assert(strcmp(cmd->argv[5], "$1") == 0);
+
+	// Quotes keep an argument even when it comes out empty
+	strcpy(buf, "echo \"$PARSER_UNSET\" '' x \"\"");
+	cmd->argc = 0;
+	assert(parse(cmd, buf) == kParseOK);
+	assert(cmd->argc == 5);
+	assert(strcmp(cmd->argv[1], "") == 0);
+	assert(strcmp(cmd->argv[2], "") == 0);
+	assert(strcmp(cmd->argv[3], "x") == 0);
+	assert(strcmp(cmd->argv[4], "") == 0);
+
+	// Status and pid
+	char pid[24];
+	sprintf(pid, "%d", (int)getpid());
+	int saved_status = last_status;
+	last_status = 42;
+	strcpy(buf, "echo $? \"$$\"");
+	cmd->argc = 0;
+	assert(parse(cmd, buf) == kParseOK);
+	assert(cmd->argc == 3);
+	assert(strcmp(cmd->argv[1], "42") == 0);
+	assert(strcmp(cmd->argv[2], pid) == 0);
+	last_status = saved_status;
+
+	// Values longer than the reference move the rest of the line to the arena
+	var_set("PARSER_TEST_LONG", "a value a good deal longer than its name", 0);
+	strcpy(buf, "echo $PARSER_TEST_LONG$PARSER_TEST_LONG x | cat \"$PARSER_TEST_LONG\" >$PARSER_TEST");
+	cmd->argc = 0;
+	assert(parse(cmd, buf) == kParseOK);
+	assert(cmd->argc == 3);
+	assert(strcmp(cmd->argv[0], "echo") == 0);
+	assert(strcmp(cmd->argv[1], "a value a good deal longer than its namea value a good deal longer than its name") == 0);
+	assert(strcmp(cmd->argv[2], "x") == 0);
+	assert(cmd->pipe && cmd->pipe->argc == 2);
+	assert(strcmp(cmd->pipe->argv[1], "a value a good deal longer than its name") == 0);
+	assert(cmd->pipe->out_file && strcmp(cmd->pipe->out_file, "foo") == 0);
+
+	// Enough of them to outgrow the arena buffer more than once
+	char* w = stpcpy(buf, "echo");
+	for (int i = 0; i < 35; i++) {
+		w = stpcpy(w, " $PARSER_TEST_LONG");
+	}
+	cmd->argc = 0;
+	cmd->pipe = NULL;
+	cmd->out_file = NULL;
+	assert(parse(cmd, buf) == kParseOK);
+	assert(cmd->argc == 36);
+	for (int i = 1; i < 36; i++) {
+		assert(strcmp(cmd->argv[i], "a value a good deal longer than its name") == 0);
+	}
+
+	// Broken references
+	const char* bad[] = {"echo ${PARSER_TEST", "echo ${}", "echo ${1x}", "echo \"${PARSER TEST}\""};
+	for (int i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+		strcpy(buf, bad[i]);
+		cmd->argc = 0;
+		assert(parse(cmd, buf) == kBadSubstitution);
+	}
+
+	// Globbing, in a directory of our own
+	char dir[] = "/tmp/parser_testXXXXXX";
+	assert(mkdtemp(dir) != NULL);
+	const char* files[] = {"a.c", "b.c", "bb.h", ".hidden.c", "sub/x", "sub2/x"};
+	char path[64];
+	sprintf(path, "%s/sub", dir);
+	mkdir(path, 0700);
+	sprintf(path, "%s/sub2", dir);
+	mkdir(path, 0700);
+	for (int i = 0; i < sizeof(files) / sizeof(files[0]); i++) {
+		sprintf(path, "%s/%s", dir, files[i]);
+		close(open(path, O_WRONLY | O_CREAT, 0600));
+	}
+
+	sprintf(buf, "ls %s/*.c %s/b?.h %s/[!a]* %s/*/x %s/.* %s/*.none", dir, dir, dir, dir, dir, dir);
+	cmd->argc = 0;
+	cmd->pipe = NULL;
+	cmd->out_file = cmd->in_file = NULL;
+	assert(parse(cmd, buf) == kParseOK);
+	const char* expect[] = {"a.c", "b.c", "bb.h", "b.c", "bb.h", "sub", "sub2", "sub/x", "sub2/x", ".hidden.c"};
+	assert(cmd->argc == 2 + sizeof(expect) / sizeof(expect[0]));
+	for (int i = 0; i < sizeof(expect) / sizeof(expect[0]); i++) {
+		sprintf(path, "%s/%s", dir, expect[i]);
+		assert(strcmp(cmd->argv[i + 1], path) == 0);
+	}
+	// No match leaves it alone
+	assert(strcmp(cmd->argv[cmd->argc - 1] + strlen(dir), "/*.none") == 0);
+
+	// Quoted or escaped, it isn't a pattern, but quoting some other part is fine
+	sprintf(buf, "ls \"%s/*.c\" %s/\\*.c '%s'/*.c", dir, dir, dir);
+	cmd->argc = 0;
+	assert(parse(cmd, buf) == kParseOK);
+	assert(cmd->argc == 5);
+	assert(strcmp(cmd->argv[1] + strlen(dir), "/*.c") == 0);
+	assert(strcmp(cmd->argv[2] + strlen(dir), "/*.c") == 0);
+	assert(strcmp(cmd->argv[3] + strlen(dir), "/a.c") == 0);
+	assert(strcmp(cmd->argv[4] + strlen(dir), "/b.c") == 0);
+
+	// A directory is read once however many patterns look in it
+	struct pathglob_cache_t glob_cache = {&arena, NULL, 0};
+	char** matches;
+	sprintf(path, "%s/*.c", dir);
+	assert(pathglob(&glob_cache, path, &matches) == 2);
+	free(matches);
+	sprintf(path, "%s/*.h", dir);
+	assert(pathglob(&glob_cache, path, &matches) == 1);
+	free(matches);
+	assert(glob_cache.dirs_read == 1);
+
+	for (int i = sizeof(files) / sizeof(files[0]) - 1; i >= 0; i--) {
+		sprintf(path, "%s/%s", dir, files[i]);
+		unlink(path);
+	}
+	sprintf(path, "%s/sub", dir);
+	rmdir(path);
+	sprintf(path, "%s/sub2", dir);
+	rmdir(path);
+	rmdir(dir);
+
+	// Chunks get merged once we've outgrown the first one, up to a few
+	// times its size
+	assert(arena.heap_allocs > 1);
+	arena_reset(&arena);
+	assert(arena.chunks == NULL && arena.chunk_size > 4096 && arena.chunk_size <= 4 * 4096);
+	cmd = new_command(&arena);
+	assert(arena.capacity == arena.chunk_size);
+
+	// A one-off spike isn't held on to
+	arena_alloc(&arena, 1 << 20);
+	arena_reset(&arena);
+	assert(arena.chunks == NULL && arena.chunk_size <= 4 * 4096);
+	cmd = new_command(&arena);
+
+	// Long arguments, shifted along so escapes and quotes land at every
+	// offset within the blocks the vectorized scanning reads
+	for (int shift = 0; shift < 64; shift++) {
+		char expect_plain[128], expect_quoted[128];
+		char* w = buf;
+		char* plain = expect_plain;
+		char* quoted = expect_quoted;
+		for (int i = 0; i < shift; i++) {
+			*w++ = ' ';
+		}
+		for (int i = 0; i < 90; i++) {
+			if (i % 13 == 7) {
+				*w++ = '\\';
+				*w++ = ' ';
+				*plain++ = ' ';
+			} else {
+				*w++ = *plain++ = 'a' + i % 26;
+			}
+		}
+		*w++ = '"';
+		for (int i = 0; i < 90; i++) {
+			if (i % 11 == 5) {
+				*w++ = '\\';
+				*w++ = '"';
+				*quoted++ = '"';
+			} else {
+				*w++ = *quoted++ = 'A' + i % 26;
+			}
+		}
+		*w++ = '"';
+		strcpy(w, " >out");
+		*plain = *quoted = '\0';
+
+		cmd->argc = 0;
+		cmd->pipe = NULL;
+		cmd->out_file = cmd->in_file = NULL;
+		assert(parse(cmd, buf) == kParseOK);
+		assert(cmd->argc == 1);
+		assert(strncmp(cmd->argv[0], expect_plain, strlen(expect_plain)) == 0);
+		assert(strcmp(cmd->argv[0] + strlen(expect_plain), expect_quoted) == 0);
+		assert(cmd->out_file && strcmp(cmd->out_file, "out") == 0);
+	}
+
 	// Cleanup
-	delete_command(cmd);
+	arena_free(&arena);
+}
+
+/**
+ * Run parser tests with each tokenizer implementation this machine supports
+ */
+int parser_tests() {
+	const char* impls[] = {"scalar", "sse2", "avx2"};
+	for (int i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+		if (scan_select(impls[i]) == 0) {
+			run_parser_tests();
+		}
+	}
+	scan_select(NULL);
 	return 0;
 }
@@ -8,11 +8,15 @@
 #define _PARSER_H
 
 #include <stdlib.h>
-enum parse_error_t {kParseOK, kUnexpectedEnd, kGivenNull, kRepeatedRedirect, kArgumentAfterRedirect, kNoArgs};
+#include "arena.h"
+enum parse_error_t {kParseOK, kUnexpectedEnd, kGivenNull, kRepeatedRedirect, kArgumentAfterRedirect, kNoArgs, kBackgroundNotLast, kBadSubstitution, kTimeoutInBackground};
 enum parse_token_t {kArgument, kRedirInput, kRedirOutput};
 
 // Yay pseudo-OO :D
 
+struct builtin_t;
+struct limits_t;
+
 struct command_t {
 	size_t argc;
 	char** argv;
@@ -20,12 +24,20 @@ struct command_t {
 	char*  out_file;
 	char*  in_file;
 	struct command_t* pipe;
+	int background; // Ended with &, only set on the first command of the chain
+	int timed;      // Started with time, also only on the first command
+	double timeout; // Seconds from a timeout prefix, 0 for none, also only on the first
+	const struct builtin_t* builtin; // Resolved by parse(), NULL for externals
+	struct limits_t* limits; // From a limit prefix, NULL if it didn't have one
+	struct arena_t* arena; // Owns this command, its argv and the rest of the chain
 };
 
-struct command_t* new_command();
+struct command_t* new_command(struct arena_t* arena);
 enum parse_error_t parse(struct command_t* cmd, char* str);
-void delete_command(struct command_t* cmd);
 enum parse_error_t add_arg(struct command_t* cmd, char* arg, enum parse_token_t token_type);
+int limit_prefix(char** argv, struct limits_t* limits);
+int timeout_prefix(char** argv, double* seconds);
+int prefix_words(char** argv, int first);
 int parser_tests();
 
 void print_cmd(struct command_t* cmd);
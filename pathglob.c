@@ -0,0 +1,421 @@
+/**
+ * @file pathglob.c
+ *
+ * Pathname expansion for *, ? and [...]. Each component of a pattern is
+ * compiled once into a short list of operations, so matching a directory
+ * entry is a length check, a suffix check for the common *.ext case, and
+ * then a walk of the operations rather than interpreting the pattern again
+ * for every entry like fnmatch does.
+ *
+ * Directories are read with getdents64 straight into the line's arena and
+ * kept for the rest of the line, so "cp *.c *.h dir" reads the current
+ * directory once.
+ */
+
+#define _GNU_SOURCE // stpcpy
+#include "pathglob.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#define PATHGLOB_READ_SIZE (1 << 16)
+
+// What getdents64 fills the buffer with
+struct linux_dirent64 {
+	uint64_t d_ino;
+	int64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+
+struct pathglob_entry_t {
+	const char* name;
+	unsigned char type; // DT_* from getdents64, DT_UNKNOWN if the filesystem won't say
+};
+
+struct pathglob_dir_t {
+	const char* path;
+	struct pathglob_entry_t* entries; // Without . and ..
+	size_t count;
+	struct pathglob_dir_t* next;
+};
+
+enum glob_op_type_t {kGlobLiteral, kGlobAny, kGlobStar, kGlobClass};
+
+struct glob_op_t {
+	enum glob_op_type_t type;
+	const char* text; // kGlobLiteral, not NUL terminated
+	size_t len;
+	uint8_t set[32];  // kGlobClass, a bit for each byte that matches
+};
+
+// One component of a pattern, the part between slashes
+struct glob_component_t {
+	struct glob_op_t* ops;
+	size_t op_count;
+	size_t min_len;   // Shortest name that could match
+	const char* tail; // Literal the name has to end with, NULL if none
+	size_t tail_len;
+	int magic;        // Whether it's a pattern at all
+	int dot;          // Whether it starts with a literal ., so it can match hidden files
+};
+
+struct results_t {
+	char** items;
+	size_t count;
+	size_t size;
+};
+
+/**
+ * Parse a bracket expression
+ * @return End of it, or NULL if it isn't closed and so is just a [
+ */
+static const char* compile_class(const char* p, const char* end, struct glob_op_t* op) {
+	memset(op->set, 0, sizeof(op->set));
+	int negate = p < end && (*p == '!' || *p == '^');
+	if (negate) {
+		p++;
+	}
+	const char* start = p;
+	while (p < end && (*p != ']' || p == start)) {
+		unsigned char lo = *p, hi = *p;
+		if (p + 2 < end && p[1] == '-' && p[2] != ']') {
+			hi = p[2];
+			p += 2;
+		}
+		for (unsigned int c = lo; c <= hi; c++) {
+			op->set[c >> 3] |= 1 << (c & 7);
+		}
+		p++;
+	}
+	if (p == end) {
+		return NULL;
+	}
+	if (negate) {
+		for (int i = 0; i < 32; i++) {
+			op->set[i] = ~op->set[i];
+		}
+	}
+	op->set[0] &= ~1; // Never the terminator
+	op->type = kGlobClass;
+	return p + 1;
+}
+
+static void compile(struct arena_t* arena, const char* p, size_t len, struct glob_component_t* comp) {
+	const char* end = p + len;
+	comp->ops = (struct glob_op_t*)arena_alloc(arena, sizeof(struct glob_op_t) * (len ? len : 1));
+	comp->op_count = 0;
+	comp->min_len = 0;
+	comp->magic = 0;
+	comp->dot = len > 0 && *p == '.';
+	struct glob_op_t* last = NULL;
+	while (p < end) {
+		struct glob_op_t* op = &comp->ops[comp->op_count];
+		const char* class_end;
+		if (*p == '*') {
+			if (last == NULL || last->type != kGlobStar) {
+				op->type = kGlobStar;
+				last = op;
+				comp->op_count++;
+			}
+			comp->magic = 1;
+			p++;
+			continue;
+		} else if (*p == '?') {
+			op->type = kGlobAny;
+			p++;
+		} else if (*p == '[' && (class_end = compile_class(p + 1, end, op)) != NULL) {
+			p = class_end;
+		} else {
+			if (last && last->type == kGlobLiteral) {
+				last->len++;
+				comp->min_len++;
+				p++;
+				continue;
+			}
+			op->type = kGlobLiteral;
+			op->text = p;
+			op->len = 1;
+			p++;
+		}
+		if (op->type != kGlobLiteral) {
+			comp->magic = 1;
+		}
+		comp->min_len++;
+		last = op;
+		comp->op_count++;
+	}
+
+	// A literal after the last * has to be at the very end of the name
+	comp->tail = NULL;
+	comp->tail_len = 0;
+	if (last && last->type == kGlobLiteral && comp->op_count > 1 && last[-1].type == kGlobStar) {
+		comp->tail = last->text;
+		comp->tail_len = last->len;
+	}
+}
+
+static int class_has(const struct glob_op_t* op, unsigned char c) {
+	return op->set[c >> 3] & (1 << (c & 7));
+}
+
+static int match(const struct glob_component_t* comp, const char* name) {
+	size_t name_len = strlen(name);
+	if (name_len < comp->min_len) {
+		return 0;
+	}
+	if (comp->tail && memcmp(name + name_len - comp->tail_len, comp->tail, comp->tail_len) != 0) {
+		return 0;
+	}
+
+	const struct glob_op_t* ops = comp->ops;
+	size_t i = 0;
+	const char* s = name;
+	// Where to pick up again if what follows the last * doesn't work out
+	size_t star_i = 0;
+	const char* star_s = NULL;
+	while (1) {
+		if (i < comp->op_count) {
+			const struct glob_op_t* op = &ops[i];
+			if (op->type == kGlobStar) {
+				star_i = ++i;
+				star_s = s;
+				continue;
+			} else if (op->type == kGlobLiteral) {
+				if (strncmp(s, op->text, op->len) == 0) {
+					s += op->len;
+					i++;
+					continue;
+				}
+			} else if (*s && (op->type == kGlobAny || class_has(op, *s))) {
+				s++;
+				i++;
+				continue;
+			}
+		} else if (*s == '\0') {
+			return 1;
+		}
+		if (star_s == NULL || *star_s == '\0') {
+			return 0;
+		}
+		s = ++star_s;
+		i = star_i;
+	}
+}
+
+/**
+ * Get a directory's entries, reading it if this line hasn't yet
+ * @param path Directory, "" for the current one
+ */
+static struct pathglob_dir_t* read_dir(struct pathglob_cache_t* cache, const char* path) {
+	struct pathglob_dir_t* dir;
+	for (dir = cache->dirs; dir; dir = dir->next) {
+		if (strcmp(dir->path, path) == 0) {
+			return dir;
+		}
+	}
+
+	dir = (struct pathglob_dir_t*)arena_alloc(cache->arena, sizeof(struct pathglob_dir_t));
+	size_t path_len = strlen(path);
+	dir->path = (char*)memcpy(arena_alloc(cache->arena, path_len + 1), path, path_len + 1);
+	dir->entries = NULL;
+	dir->count = 0;
+	dir->next = cache->dirs;
+	cache->dirs = dir;
+
+	int fd = open(*path ? path : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0) {
+		return dir; // Nothing to match, same as empty
+	}
+	cache->dirs_read++;
+
+	static char buf[PATHGLOB_READ_SIZE];
+	struct pathglob_entry_t* entries = NULL;
+	size_t size = 0;
+	long n;
+	while ((n = syscall(SYS_getdents64, fd, buf, sizeof(buf))) > 0) {
+		// Names always fit in the records they came in
+		char* names = (char*)arena_alloc(cache->arena, n);
+		for (long offset = 0; offset < n;) {
+			struct linux_dirent64* d = (struct linux_dirent64*)(buf + offset);
+			offset += d->d_reclen;
+			if (d->d_name[0] == '.' && (d->d_name[1] == '\0' || (d->d_name[1] == '.' && d->d_name[2] == '\0'))) {
+				continue;
+			}
+			if (dir->count == size) {
+				size = size ? size * 2 : 64;
+				entries = (struct pathglob_entry_t*)realloc(entries, sizeof(struct pathglob_entry_t) * size);
+			}
+			entries[dir->count].name = names;
+			entries[dir->count].type = d->d_type;
+			dir->count++;
+			names = stpcpy(names, d->d_name) + 1;
+		}
+	}
+	close(fd);
+
+	if (dir->count) {
+		size_t bytes = sizeof(struct pathglob_entry_t) * dir->count;
+		dir->entries = (struct pathglob_entry_t*)memcpy(arena_alloc(cache->arena, bytes), entries, bytes);
+	}
+	free(entries);
+	return dir;
+}
+
+static void add_result(struct pathglob_cache_t* cache, struct results_t* results, const char* path, size_t len) {
+	if (results->count == results->size) {
+		results->size = results->size ? results->size * 2 : 16;
+		results->items = (char**)realloc(results->items, sizeof(char*) * results->size);
+	}
+	results->items[results->count++] = (char*)memcpy(arena_alloc(cache->arena, len + 1), path, len + 1);
+}
+
+static int is_dir(const struct pathglob_entry_t* entry, const char* path) {
+	if (entry->type == DT_DIR) {
+		return 1;
+	} else if (entry->type != DT_LNK && entry->type != DT_UNKNOWN) {
+		return 0;
+	}
+	struct stat st;
+	return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+/**
+ * Match what's left of the pattern, starting in the directory we've got to
+ * @param path The directory so far, with a trailing slash unless it's empty.
+ *             Has room for PATH_MAX bytes.
+ * @param rest The rest of the pattern
+ */
+static void glob_from(struct pathglob_cache_t* cache, char* path, size_t path_len, const char* rest,
+		struct results_t* results) {
+	const char* slash = strchr(rest, '/');
+	size_t comp_len = slash ? (size_t)(slash - rest) : strlen(rest);
+	const char* next = NULL;
+	if (slash) {
+		for (next = slash; *next == '/'; next++) {}
+	}
+
+	struct glob_component_t comp;
+	compile(cache->arena, rest, comp_len, &comp);
+	if (!comp.magic) {
+		if (path_len + comp_len + 1 >= PATH_MAX) {
+			return;
+		}
+		memcpy(path + path_len, rest, comp_len);
+		size_t len = path_len + comp_len;
+		if (slash) {
+			path[len++] = '/';
+		}
+		path[len] = '\0';
+		if (next && *next) {
+			glob_from(cache, path, len, next, results);
+			return;
+		}
+		// Only what's really there
+		struct stat st;
+		if (slash ? stat(path, &st) == 0 && S_ISDIR(st.st_mode) : lstat(path, &st) == 0) {
+			add_result(cache, results, path, len);
+		}
+		return;
+	}
+
+	path[path_len] = '\0';
+	struct pathglob_dir_t* dir = read_dir(cache, path);
+	for (size_t i = 0; i < dir->count; i++) {
+		const struct pathglob_entry_t* entry = &dir->entries[i];
+		if ((entry->name[0] == '.' && !comp.dot) || !match(&comp, entry->name)) {
+			continue;
+		}
+		size_t name_len = strlen(entry->name);
+		if (path_len + name_len + 1 >= PATH_MAX) {
+			continue;
+		}
+		memcpy(path + path_len, entry->name, name_len + 1);
+		size_t len = path_len + name_len;
+		if (slash) {
+			if (!is_dir(entry, path)) {
+				continue;
+			}
+			path[len++] = '/';
+			path[len] = '\0';
+		}
+		if (next && *next) {
+			glob_from(cache, path, len, next, results);
+		} else {
+			add_result(cache, results, path, len);
+		}
+	}
+}
+
+/**
+ * Whether there's anything to expand, a * or ?, or a [ with a ] to match
+ */
+static int has_magic(const char* p) {
+	for (; *p; p++) {
+		if (*p == '*' || *p == '?') {
+			return 1;
+		} else if (*p == '[') {
+			const char* close = p + 1;
+			if (*close == '!' || *close == '^') {
+				close++;
+			}
+			if (*close == ']') {
+				close++;
+			}
+			while (*close && *close != ']' && *close != '/') {
+				close++;
+			}
+			if (*close == ']') {
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
+
+static int compare_paths(const void* a, const void* b) {
+	return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+/**
+ * Find the paths a pattern matches
+ * @param cache Directories already read for this line
+ * @param pattern Pattern, with any quoting already removed
+ * @param matches Set to a sorted array of the matching paths, which the
+ *                caller frees. The paths themselves live in the arena.
+ * @return Number of matches, 0 if none or it wasn't a pattern at all
+ */
+size_t pathglob(struct pathglob_cache_t* cache, const char* pattern, char*** matches) {
+	*matches = NULL;
+	if (!has_magic(pattern)) {
+		return 0;
+	}
+
+	struct results_t results = {NULL, 0, 0};
+	char path[PATH_MAX];
+	size_t path_len = 0;
+	if (*pattern == '/') {
+		path[path_len++] = '/';
+		while (*pattern == '/') {
+			pattern++;
+		}
+	}
+	if (*pattern) {
+		glob_from(cache, path, path_len, pattern, &results);
+	}
+
+	if (results.count == 0) {
+		free(results.items);
+		return 0;
+	}
+	qsort(results.items, results.count, sizeof(char*), compare_paths);
+	*matches = results.items;
+	return results.count;
+}
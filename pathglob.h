@@ -0,0 +1,23 @@
+/**
+ * @file pathglob.h
+ */
+
+#ifndef _PATHGLOB_H
+#define _PATHGLOB_H
+
+#include "arena.h"
+
+struct pathglob_dir_t;
+
+// Directories read while expanding one line's patterns, so a directory
+// several patterns look in is only read once. Everything in it comes from
+// the line's arena and goes when the line does.
+struct pathglob_cache_t {
+	struct arena_t* arena;
+	struct pathglob_dir_t* dirs;
+	size_t dirs_read; // Directories actually read, for tests and benchmarks
+};
+
+size_t pathglob(struct pathglob_cache_t* cache, const char* pattern, char*** matches);
+
+#endif // _PATHGLOB_H
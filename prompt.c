@@ -0,0 +1,183 @@
+/**
+ * @file prompt.c
+ *
+ * Builds the prompt from $PS1. The format is only split into segments when
+ * PS1 changes, and the prompt is only rendered again after something it
+ * shows (the directory, $HOME or $PS1) changes, so an unchanged prompt
+ * costs nothing per line.
+ *
+ * Supported escapes: \w directory with ~ for $HOME, \W last part of the
+ * directory, \u user, \h host, \$ # for root else $, \n newline, \\ backslash
+ */
+
+#include "prompt.h"
+#include "utility.h"
+#include "stats.h"
+#include "vars.h"
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pwd.h>
+#include <limits.h>
+
+#define DEFAULT_PS1 "\\w $ "
+
+enum segment_type_t {kSegText, kSegDir, kSegDirBase};
+
+struct segment_t {
+	enum segment_type_t type;
+	char* text; // Only for kSegText
+};
+
+static char* format = NULL;           // PS1 the segments were made from
+static struct segment_t* segments = NULL;
+static size_t segment_count = 0;
+static char* prompt = NULL;           // Last rendered prompt
+static int dirty = 1;
+
+/**
+ * Add a piece of constant text, merging it with the previous one if possible
+ */
+static void add_text(const char* text, size_t len) {
+	struct segment_t* last = segment_count ? &segments[segment_count - 1] : NULL;
+	if (last && last->type == kSegText) {
+		size_t old_len = strlen(last->text);
+		last->text = (char*)realloc(last->text, old_len + len + 1);
+		memcpy(last->text + old_len, text, len);
+		last->text[old_len + len] = '\0';
+	} else {
+		segments = (struct segment_t*)realloc(segments, sizeof(struct segment_t) * (segment_count + 1));
+		segments[segment_count].type = kSegText;
+		segments[segment_count].text = strndup(text, len);
+		segment_count++;
+	}
+}
+
+static void add_segment(enum segment_type_t type) {
+	segments = (struct segment_t*)realloc(segments, sizeof(struct segment_t) * (segment_count + 1));
+	segments[segment_count].type = type;
+	segments[segment_count].text = NULL;
+	segment_count++;
+}
+
+/**
+ * Split a PS1 format into segments. Anything that can't change while we're
+ * running (user, host, privilege) is turned into text right away.
+ * @param ps1 Format to compile
+ */
+static void compile(const char* ps1) {
+	for (size_t i = 0; i < segment_count; i++) {
+		free(segments[i].text);
+	}
+	segment_count = 0;
+	free(format);
+	format = strdup(ps1);
+
+	const char* s = ps1;
+	while (*s) {
+		const char* escape = strchr(s, '\\');
+		if (escape == NULL) {
+			add_text(s, strlen(s));
+			break;
+		}
+		add_text(s, escape - s);
+		s = escape + 1;
+		if (*s == 'w') {
+			add_segment(kSegDir);
+		} else if (*s == 'W') {
+			add_segment(kSegDirBase);
+		} else if (*s == 'u') {
+			struct passwd* pw = getpwuid(geteuid());
+			const char* user = pw ? pw->pw_name : "?";
+			add_text(user, strlen(user));
+		} else if (*s == 'h') {
+			char host[HOST_NAME_MAX + 1];
+			if (gethostname(host, sizeof(host)) < 0) {
+				strcpy(host, "?");
+			}
+			host[HOST_NAME_MAX] = '\0';
+			// Only the part up to the first dot, like bash
+			add_text(host, strcspn(host, "."));
+		} else if (*s == '$') {
+			add_text(geteuid() == 0 ? "#" : "$", 1);
+		} else if (*s == 'n') {
+			add_text("\n", 1);
+		} else if (*s == '\0') {
+			add_text("\\", 1);
+			break;
+		} else {
+			// \\ becomes a backslash, anything we don't know is left as is
+			add_text(s - 1, *s == '\\' ? 1 : 2);
+		}
+		s++;
+	}
+}
+
+/**
+ * Get the prompt to show, rendering it again only if it's out of date
+ * @return The prompt, valid until the next call
+ */
+const char* prompt_get() {
+	if (!dirty) {
+		return prompt;
+	}
+	STATS_START(start);
+
+	const char* ps1 = var_get("PS1");
+	if (ps1 == NULL) {
+		ps1 = DEFAULT_PS1;
+	}
+	if (format == NULL || strcmp(format, ps1) != 0) {
+		compile(ps1);
+	}
+
+	const char* dir = currentDir();
+	const char* home = var_get("HOME");
+	size_t home_len = home ? strlen(home) : 0;
+	// Only replace $HOME if it's a whole path component of the directory
+	int in_home = home_len > 0 && strncmp(dir, home, home_len) == 0 &&
+		(dir[home_len] == '\0' || dir[home_len] == '/');
+	const char* base = strrchr(dir, '/');
+	base = (base && base[1]) ? base + 1 : dir;
+
+	size_t len = 0;
+	for (size_t i = 0; i < segment_count; i++) {
+		if (segments[i].type == kSegText) {
+			len += strlen(segments[i].text);
+		} else if (segments[i].type == kSegDir) {
+			len += strlen(dir) + 1;
+		} else {
+			len += strlen(base);
+		}
+	}
+
+	free(prompt);
+	prompt = (char*)malloc(len + 1);
+	char* out = prompt;
+	for (size_t i = 0; i < segment_count; i++) {
+		if (segments[i].type == kSegText) {
+			out = stpcpy(out, segments[i].text);
+		} else if (segments[i].type == kSegDir) {
+			if (in_home) {
+				*out++ = '~';
+				out = stpcpy(out, dir + home_len);
+			} else {
+				out = stpcpy(out, dir);
+			}
+		} else {
+			out = stpcpy(out, in_home && dir[home_len] == '\0' ? "~" : base);
+		}
+	}
+	*out = '\0';
+
+	dirty = 0;
+	STATS_STOP(kStatPrompt, start);
+	return prompt;
+}
+
+/**
+ * Make the next prompt_get() render the prompt again
+ */
+void prompt_invalidate() {
+	dirty = 1;
+}
@@ -0,0 +1,11 @@
+/**
+ * @file prompt.h
+ */
+
+#ifndef _PROMPT_H
+#define _PROMPT_H
+
+const char* prompt_get();
+void prompt_invalidate();
+
+#endif // _PROMPT_H
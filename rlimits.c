@@ -0,0 +1,230 @@
+/**
+ * @file rlimits.c
+ *
+ * Resource limits and priorities for the commands the shell runs, from
+ * the limit builtin or a limit prefix on a command. They're applied in the
+ * child after fork, so the shell itself is never limited.
+ */
+
+#include "rlimits.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_SHIFT 13
+
+struct limits_t limits_default;
+
+/**
+ * Read a limit, which can be unlimited or have a K, M, G or T suffix
+ * @return 0 on success, -1 if it isn't a limit
+ */
+static int parse_value(const char* text, rlim_t* value, int sized) {
+	if (strcmp(text, "unlimited") == 0) {
+		*value = RLIM_INFINITY;
+		return 0;
+	}
+	char* end;
+	errno = 0;
+	unsigned long long n = strtoull(text, &end, 10);
+	if (end == text || *text == '-' || errno == ERANGE) {
+		return -1;
+	}
+	const char* suffixes = "KMGT";
+	const char* suffix = sized && *end ? strchr(suffixes, *end) : NULL;
+	int shift = 0;
+	if (suffix) {
+		shift = 10 * (suffix - suffixes + 1);
+		end++;
+	}
+	// Too big to be anything but unlimited, which has to be asked for
+	if (*end != '\0' || n > (RLIM_INFINITY - 1) >> shift) {
+		return -1;
+	}
+	*value = n << shift;
+	return 0;
+}
+
+/**
+ * Read limit's options
+ * @param limits Where to put what they set
+ * @param argv Arguments after limit, NULL terminated
+ * @param complain Whether to say what's wrong with a bad option
+ * @return How many arguments were options, or -1 if one was bad
+ */
+int limits_parse(struct limits_t* limits, char** argv, int complain) {
+	int i = 0;
+	for (; argv[i] && argv[i][0] == '-' && argv[i][1] && !argv[i][2]; i += 2) {
+		const char* value = argv[i + 1];
+		char option = argv[i][1];
+		int ok = value != NULL;
+		if (ok && option == 't') {
+			ok = parse_value(value, &limits->cpu, 0) == 0;
+			limits->set |= kLimitCpu;
+		} else if (ok && option == 'v') {
+			ok = parse_value(value, &limits->as, 1) == 0;
+			limits->set |= kLimitAs;
+		} else if (ok && option == 'n') {
+			ok = parse_value(value, &limits->nofile, 0) == 0;
+			limits->set |= kLimitNofile;
+		} else if (ok && option == 'u') {
+			ok = parse_value(value, &limits->nproc, 0) == 0;
+			limits->set |= kLimitNproc;
+		} else if (ok && option == 'N') {
+			char* end;
+			limits->nice = strtol(value, &end, 10);
+			ok = end != value && *end == '\0' && limits->nice >= -20 && limits->nice <= 19;
+			limits->set |= kLimitNice;
+		} else if (ok && option == 'I') {
+			char* end;
+			limits->io_class = strtol(value, &end, 10);
+			limits->io_level = 4; // What the kernel uses for best effort by default
+			if (*end == ':') {
+				char* level = end + 1;
+				limits->io_level = strtol(level, &end, 10);
+				ok = end != level;
+			}
+			ok = ok && *end == '\0' && limits->io_class >= 1 && limits->io_class <= 3 &&
+				limits->io_level >= 0 && limits->io_level <= 7;
+			limits->set |= kLimitIo;
+		} else {
+			ok = 0;
+		}
+		if (!ok) {
+			if (complain) {
+				printf("limit: %s: bad option or value\n", argv[i]);
+			}
+			return -1;
+		}
+	}
+	return i;
+}
+
+/**
+ * Overwrite limits in into with any that from sets
+ */
+void limits_merge(struct limits_t* into, const struct limits_t* from) {
+	if (from->set & kLimitCpu) {
+		into->cpu = from->cpu;
+	}
+	if (from->set & kLimitAs) {
+		into->as = from->as;
+	}
+	if (from->set & kLimitNofile) {
+		into->nofile = from->nofile;
+	}
+	if (from->set & kLimitNproc) {
+		into->nproc = from->nproc;
+	}
+	if (from->set & kLimitNice) {
+		into->nice = from->nice;
+	}
+	if (from->set & kLimitIo) {
+		into->io_class = from->io_class;
+		into->io_level = from->io_level;
+	}
+	into->set |= from->set;
+}
+
+/**
+ * Set both the soft and hard limit, so the command can't raise it again.
+ * A hard limit above the one we have is quietly kept at ours.
+ * @param slack How far over the soft limit the hard one goes
+ */
+static int set_limit(int resource, rlim_t value, rlim_t slack, const char* name) {
+	struct rlimit limit;
+	if (getrlimit(resource, &limit) < 0) {
+		perror(name);
+		return -1;
+	}
+	if (limit.rlim_max != RLIM_INFINITY && (value == RLIM_INFINITY || value > limit.rlim_max)) {
+		value = limit.rlim_max;
+	}
+	limit.rlim_cur = value;
+	if (value != RLIM_INFINITY && (limit.rlim_max == RLIM_INFINITY || value + slack <= limit.rlim_max)) {
+		limit.rlim_max = value + slack;
+	} else {
+		limit.rlim_max = value;
+	}
+	if (setrlimit(resource, &limit) < 0) {
+		perror(name);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Apply limits to this process, meant for a child between fork and exec
+ * @return 0 on success, -1 if any of them couldn't be applied
+ */
+int limits_apply(const struct limits_t* limits) {
+	int ret = 0;
+	// A second over the CPU limit it's killed, but it's sent SIGXCPU first
+	if ((limits->set & kLimitCpu) && set_limit(RLIMIT_CPU, limits->cpu, 1, "limit: cpu") < 0) {
+		ret = -1;
+	}
+	if ((limits->set & kLimitAs) && set_limit(RLIMIT_AS, limits->as, 0, "limit: address space") < 0) {
+		ret = -1;
+	}
+	if ((limits->set & kLimitNofile) && set_limit(RLIMIT_NOFILE, limits->nofile, 0, "limit: open files") < 0) {
+		ret = -1;
+	}
+	if ((limits->set & kLimitNproc) && set_limit(RLIMIT_NPROC, limits->nproc, 0, "limit: processes") < 0) {
+		ret = -1;
+	}
+	if ((limits->set & kLimitNice) && setpriority(PRIO_PROCESS, 0, limits->nice) < 0) {
+		perror("limit: nice");
+		ret = -1;
+	}
+	if (limits->set & kLimitIo) {
+		int prio = limits->io_class << IOPRIO_CLASS_SHIFT | limits->io_level;
+		if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, prio) < 0) {
+			perror("limit: io priority");
+			ret = -1;
+		}
+	}
+	return ret;
+}
+
+static char* describe_value(char* w, char* end, const char* name, rlim_t value, const char* unit) {
+	if (value == RLIM_INFINITY) {
+		return w + snprintf(w, end - w, " %s=unlimited", name);
+	}
+	return w + snprintf(w, end - w, " %s=%llu%s", name, (unsigned long long)value, unit);
+}
+
+/**
+ * Describe limits by resource, e.g. "cpu=10s nofile=64", for limit to
+ * print the defaults and for the time report
+ * @return buf, which is empty if nothing is set
+ */
+char* limits_describe(const struct limits_t* limits, char* buf, size_t size) {
+	char line[256];
+	char* w = line;
+	char* end = line + sizeof(line);
+	*w = '\0';
+	if (limits->set & kLimitCpu) {
+		w = describe_value(w, end, "cpu", limits->cpu, "s");
+	}
+	if (limits->set & kLimitAs) {
+		w = describe_value(w, end, "as", limits->as, "");
+	}
+	if (limits->set & kLimitNofile) {
+		w = describe_value(w, end, "nofile", limits->nofile, "");
+	}
+	if (limits->set & kLimitNproc) {
+		w = describe_value(w, end, "nproc", limits->nproc, "");
+	}
+	if (limits->set & kLimitNice) {
+		w += snprintf(w, end - w, " nice=%d", limits->nice);
+	}
+	if (limits->set & kLimitIo) {
+		w += snprintf(w, end - w, " io=%d:%d", limits->io_class, limits->io_level);
+	}
+	snprintf(buf, size, "%s", line[0] ? line + 1 : "");
+	return buf;
+}
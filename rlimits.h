@@ -0,0 +1,40 @@
+/**
+ * @file rlimits.h
+ */
+
+#ifndef _RLIMITS_H
+#define _RLIMITS_H
+
+#include <stddef.h>
+#include <sys/resource.h>
+
+enum limit_flag_t {
+	kLimitCpu = 1 << 0,
+	kLimitAs = 1 << 1,
+	kLimitNofile = 1 << 2,
+	kLimitNproc = 1 << 3,
+	kLimitNice = 1 << 4,
+	kLimitIo = 1 << 5,
+};
+
+// What a command is allowed, set by limit. Only the fields in set mean
+// anything, the rest are inherited from the shell as usual.
+struct limits_t {
+	unsigned int set; // limit_flag_t bits
+	rlim_t cpu;       // Seconds of CPU time
+	rlim_t as;        // Bytes of address space
+	rlim_t nofile;    // Open files
+	rlim_t nproc;     // Processes for the user
+	int nice;
+	int io_class;     // 1 realtime, 2 best effort, 3 idle, as in ionice(1)
+	int io_level;     // 0 (most) to 7 (least) within the class
+};
+
+extern struct limits_t limits_default; // Set by limit without a command
+
+int limits_parse(struct limits_t* limits, char** argv, int complain);
+void limits_merge(struct limits_t* into, const struct limits_t* from);
+int limits_apply(const struct limits_t* limits);
+char* limits_describe(const struct limits_t* limits, char* buf, size_t size);
+
+#endif // _RLIMITS_H
@@ -0,0 +1,162 @@
+/**
+ * @file scan.c
+ *
+ * Finds the next interesting character in a string, 16 or 32 bytes at a
+ * time where the CPU allows it. The parser uses this to skip over the plain
+ * runs of text between delimiters, quotes and escapes instead of testing
+ * every byte against each of them.
+ *
+ * The best implementation is picked on the first call: AVX2 if the CPU has
+ * it, else SSE2 (always there on x86-64), else a plain loop.
+ */
+
+#include "scan.h"
+#include <stdint.h>
+#include <string.h>
+
+typedef const char* (*scan_func_t)(const char* str, const char* set, size_t set_len);
+
+static const char* scan_scalar(const char* str, const char* set, size_t set_len) {
+	while (*str) {
+		for (size_t i = 0; i < set_len; i++) {
+			if (*str == set[i]) {
+				return str;
+			}
+		}
+		str++;
+	}
+	return str;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+// The vector versions load whole aligned blocks, which can go past the end
+// of the string (and before its start), but never into another page, so
+// it's safe even though ASan would think otherwise.
+
+__attribute__((target("sse2"), no_sanitize_address))
+static const char* scan_sse2(const char* str, const char* set, size_t set_len) {
+	__m128i needles[SCAN_MAX_SET];
+	for (size_t i = 0; i < set_len; i++) {
+		needles[i] = _mm_set1_epi8(set[i]);
+	}
+	const __m128i zero = _mm_setzero_si128();
+
+	uintptr_t offset = (uintptr_t)str & 15;
+	const char* block = str - offset;
+	// Ignore matches in the bytes before str in the first block
+	unsigned int skip = ~0u << offset;
+	while (1) {
+		__m128i bytes = _mm_load_si128((const __m128i*)block);
+		__m128i hits = _mm_cmpeq_epi8(bytes, zero);
+		for (size_t i = 0; i < set_len; i++) {
+			hits = _mm_or_si128(hits, _mm_cmpeq_epi8(bytes, needles[i]));
+		}
+		unsigned int mask = (unsigned int)_mm_movemask_epi8(hits) & skip;
+		if (mask) {
+			return block + __builtin_ctz(mask);
+		}
+		block += 16;
+		skip = ~0u;
+	}
+}
+
+__attribute__((target("avx2"), no_sanitize_address))
+static const char* scan_avx2(const char* str, const char* set, size_t set_len) {
+	__m256i needles[SCAN_MAX_SET];
+	for (size_t i = 0; i < set_len; i++) {
+		needles[i] = _mm256_set1_epi8(set[i]);
+	}
+	const __m256i zero = _mm256_setzero_si256();
+
+	uintptr_t offset = (uintptr_t)str & 31;
+	const char* block = str - offset;
+	unsigned int skip = ~0u << offset;
+	while (1) {
+		__m256i bytes = _mm256_load_si256((const __m256i*)block);
+		__m256i hits = _mm256_cmpeq_epi8(bytes, zero);
+		for (size_t i = 0; i < set_len; i++) {
+			hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(bytes, needles[i]));
+		}
+		unsigned int mask = (unsigned int)_mm256_movemask_epi8(hits) & skip;
+		if (mask) {
+			return block + __builtin_ctz(mask);
+		}
+		block += 32;
+		skip = ~0u;
+	}
+}
+#endif
+
+struct scan_impl_t {
+	const char* name;
+	scan_func_t func;
+};
+
+// Best first
+static const struct scan_impl_t impls[] = {
+#if defined(__x86_64__) || defined(__i386__)
+	{"avx2", scan_avx2},
+	{"sse2", scan_sse2},
+#endif
+	{"scalar", scan_scalar},
+	{NULL, NULL}
+};
+
+static const struct scan_impl_t* impl = NULL;
+
+static int supported(const struct scan_impl_t* candidate) {
+#if defined(__x86_64__) || defined(__i386__)
+	if (candidate->func == scan_avx2) {
+		return __builtin_cpu_supports("avx2");
+	} else if (candidate->func == scan_sse2) {
+		return __builtin_cpu_supports("sse2");
+	}
+#endif
+	return 1;
+}
+
+/**
+ * Find the first character in str that's either in set or is the terminator
+ * @param str String to search
+ * @param set Characters to look for, longer than SCAN_MAX_SET is scanned
+ *            a byte at a time
+ * @return Pointer to the character found
+ */
+const char* scan_for(const char* str, const char* set) {
+	if (impl == NULL) {
+		scan_select(NULL);
+	}
+	size_t set_len = strlen(set);
+	if (set_len > SCAN_MAX_SET) {
+		// Too many for the vector versions to keep in registers
+		return scan_scalar(str, set, set_len);
+	}
+	return impl->func(str, set, set_len);
+}
+
+/**
+ * Choose which implementation scan_for() uses
+ * @param name "avx2", "sse2" or "scalar", or NULL for the best one available
+ * @return 0 on success, -1 if it isn't available on this machine
+ */
+int scan_select(const char* name) {
+	for (const struct scan_impl_t* candidate = impls; candidate->name; candidate++) {
+		if ((name == NULL || strcmp(candidate->name, name) == 0) && supported(candidate)) {
+			impl = candidate;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/**
+ * @return Name of the implementation in use
+ */
+const char* scan_name() {
+	if (impl == NULL) {
+		scan_select(NULL);
+	}
+	return impl->name;
+}
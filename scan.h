@@ -0,0 +1,16 @@
+/**
+ * @file scan.h
+ */
+
+#ifndef _SCAN_H
+#define _SCAN_H
+
+// Most characters scan_for() can look for at once with the vector versions,
+// besides '\0'. Longer sets still work but fall back to the plain loop.
+#define SCAN_MAX_SET 16
+
+const char* scan_for(const char* str, const char* set);
+int scan_select(const char* name);
+const char* scan_name();
+
+#endif // _SCAN_H
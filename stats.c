@@ -0,0 +1,120 @@
+/**
+ * @file stats.c
+ *
+ * Counters and timers for the shell's own hot paths, for finding out where
+ * a long session spends its time. Each event keeps a histogram with one
+ * bucket per power of two nanoseconds, so recording is a clock read and a
+ * few adds, and percentiles are only as precise as a bucket.
+ */
+
+#include "stats.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define STATS_BUCKETS 64
+
+struct stat_t {
+	uint64_t count;
+	uint64_t total_ns;
+	uint64_t min_ns;
+	uint64_t max_ns;
+	uint64_t buckets[STATS_BUCKETS]; // Bucket b holds times in [2^b, 2^(b+1)) ns, and 0 goes in 0
+};
+
+static struct stat_t stats[kStatCount];
+
+/**
+ * @return Nanoseconds on the monotonic clock
+ */
+uint64_t stats_now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * Count one occurrence of an event
+ * @param id Event
+ * @param ns How long it took
+ */
+void stats_record(enum stat_id_t id, uint64_t ns) {
+	struct stat_t* stat = &stats[id];
+	if (stat->count == 0 || ns < stat->min_ns) {
+		stat->min_ns = ns;
+	}
+	if (ns > stat->max_ns) {
+		stat->max_ns = ns;
+	}
+	stat->count++;
+	stat->total_ns += ns;
+	stat->buckets[ns ? 63 - __builtin_clzll(ns) : 0]++;
+}
+
+void stats_reset() {
+	memset(stats, 0, sizeof(stats));
+}
+
+#ifdef NOSTATS
+void stats_print(int json) {
+	printf("stats: this shell was built with NOSTATS\n");
+}
+#else
+static const char* stat_names[kStatCount] = {"parse", "find_builtin", "launch", "wait", "prompt"};
+
+/**
+ * Estimate a percentile from the histogram
+ * @return Upper bound of the bucket the percentile falls in, in ns
+ */
+static uint64_t percentile(const struct stat_t* stat, int pct) {
+	uint64_t want = (stat->count * pct + 99) / 100;
+	uint64_t seen = 0;
+	for (int b = 0; b < STATS_BUCKETS; b++) {
+		seen += stat->buckets[b];
+		if (seen >= want) {
+			uint64_t bound = b < 63 ? (uint64_t)2 << b : UINT64_MAX;
+			// Never claim more than we actually saw
+			return bound < stat->max_ns ? bound : stat->max_ns;
+		}
+	}
+	return stat->max_ns;
+}
+
+/**
+ * Print every event's counters
+ * @param json One JSON object per line, histogram included, instead of a table
+ */
+void stats_print(int json) {
+	if (!json) {
+		printf("%-14s %10s %12s %10s %10s %10s %10s %10s\n",
+			"event", "count", "total_ms", "mean_us", "min_us", "p50_us", "p99_us", "max_us");
+	}
+	for (int i = 0; i < kStatCount; i++) {
+		const struct stat_t* stat = &stats[i];
+		uint64_t mean_ns = stat->count ? stat->total_ns / stat->count : 0;
+		if (!json) {
+			printf("%-14s %10llu %12.3f %10.3f %10.3f %10.3f %10.3f %10.3f\n",
+				stat_names[i], (unsigned long long)stat->count, stat->total_ns / 1e6,
+				mean_ns / 1e3, stat->min_ns / 1e3, percentile(stat, 50) / 1e3,
+				percentile(stat, 99) / 1e3, stat->max_ns / 1e3);
+			continue;
+		}
+
+		printf("{\"stat\": \"%s\", \"count\": %llu, \"total_ns\": %llu, \"min_ns\": %llu, "
+			"\"max_ns\": %llu, \"p50_ns\": %llu, \"p99_ns\": %llu, \"histogram\": {",
+			stat_names[i], (unsigned long long)stat->count, (unsigned long long)stat->total_ns,
+			(unsigned long long)stat->min_ns, (unsigned long long)stat->max_ns,
+			(unsigned long long)percentile(stat, 50), (unsigned long long)percentile(stat, 99));
+		// Keyed by each bucket's lower bound in ns, empty buckets left out
+		int first = 1;
+		for (int b = 0; b < STATS_BUCKETS; b++) {
+			if (stat->buckets[b]) {
+				printf("%s\"%llu\": %llu", first ? "" : ", ",
+					b ? 1ULL << b : 0ULL, (unsigned long long)stat->buckets[b]);
+				first = 0;
+			}
+		}
+		printf("}}\n");
+	}
+}
+#endif
@@ -0,0 +1,33 @@
+/**
+ * @file stats.h
+ */
+
+#ifndef _STATS_H
+#define _STATS_H
+
+#include <stdint.h>
+
+enum stat_id_t {
+	kStatParse,
+	kStatFindBuiltin,
+	kStatLaunch,  // posix_spawn or fork of one stage, including its exec
+	kStatWait,    // Waiting for a foreground job
+	kStatPrompt,  // Rendering the prompt
+	kStatCount
+};
+
+// Build with NOSTATS=1 to compile the timers out of the hot paths
+#ifdef NOSTATS
+#define STATS_START(var)
+#define STATS_STOP(id, var)
+#else
+#define STATS_START(var) uint64_t var = stats_now()
+#define STATS_STOP(id, var) stats_record(id, stats_now() - (var))
+#endif
+
+uint64_t stats_now();
+void stats_record(enum stat_id_t id, uint64_t ns);
+void stats_reset();
+void stats_print(int json);
+
+#endif // _STATS_H
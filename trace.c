@@ -0,0 +1,240 @@
+/**
+ * @file trace.c
+ *
+ * Writes a timeline of what the shell did to $SHELL_TRACE, in the Chrome
+ * trace-event format that chrome://tracing and Perfetto load. Each pipeline
+ * shows up as a process keyed by its process group, with a thread per
+ * stage, and the shell's own parsing, builtins and waits get a row of their
+ * own.
+ *
+ * Events are formatted into a buffer in memory. When it fills up it's
+ * swapped for a spare and a writer thread writes it out, so the shell never
+ * waits on the disk unless the writer has fallen a whole buffer behind.
+ */
+
+#include "trace.h"
+#include "vars.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+
+#define TRACE_BUFFER_SIZE (1 << 16)
+#define TRACE_EVENT_MAX 1024
+
+int trace_enabled = 0;
+
+static int trace_fd = -1;
+static int events = 0; // Written so far, to know whether we need a comma
+
+static char buffers[2][TRACE_BUFFER_SIZE];
+static int active = 0;   // Buffer being filled
+static size_t used = 0;
+static int pending = -1; // Buffer waiting for the writer, if any
+static size_t pending_len = 0;
+static int stopping = 0;
+
+static pthread_t writer;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done = PTHREAD_COND_INITIALIZER;
+
+static void* write_buffers(void* arg) {
+	pthread_mutex_lock(&lock);
+	while (1) {
+		while (pending < 0 && !stopping) {
+			pthread_cond_wait(&work, &lock);
+		}
+		if (pending < 0) {
+			break;
+		}
+		const char* buf = buffers[pending];
+		size_t len = pending_len;
+		pthread_mutex_unlock(&lock);
+
+		while (len > 0) {
+			ssize_t n = write(trace_fd, buf, len);
+			if (n < 0) {
+				perror("trace: Failed to write");
+				break;
+			}
+			buf += n;
+			len -= n;
+		}
+
+		pthread_mutex_lock(&lock);
+		pending = -1;
+		pthread_cond_signal(&done);
+	}
+	pthread_mutex_unlock(&lock);
+	return NULL;
+}
+
+/**
+ * Hand the active buffer to the writer and start filling the other one
+ */
+static void swap_buffers() {
+	pthread_mutex_lock(&lock);
+	while (pending >= 0) {
+		pthread_cond_wait(&done, &lock);
+	}
+	pending = active;
+	pending_len = used;
+	pthread_cond_signal(&work);
+	pthread_mutex_unlock(&lock);
+
+	active = !active;
+	used = 0;
+}
+
+static void append(const char* event, size_t len) {
+	if (used + len > TRACE_BUFFER_SIZE) {
+		swap_buffers();
+	}
+	memcpy(buffers[active] + used, event, len);
+	used += len;
+}
+
+static void forked_child() {
+	// The writer thread didn't come with us, and the parent owns the file
+	trace_enabled = 0;
+	trace_fd = -1;
+}
+
+static void trace_open(const char* path) {
+	static int registered = 0;
+	if ((trace_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666)) < 0) {
+		perror("trace: Failed to open trace file");
+		return;
+	}
+	stopping = 0;
+	events = 0;
+	used = 0;
+	// The writer inherits our mask. It mustn't take signals, SIGCHLD in
+	// particular has to be held off by the main thread when it needs to be.
+	sigset_t all, old_mask;
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old_mask);
+	int err = pthread_create(&writer, NULL, write_buffers, NULL);
+	pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+	if (err != 0) {
+		printf("trace: Failed to start writer\n");
+		close(trace_fd);
+		trace_fd = -1;
+		return;
+	}
+	if (!registered) {
+		pthread_atfork(NULL, NULL, forked_child);
+		atexit(trace_close);
+		registered = 1;
+	}
+
+	append("[\n", 2);
+	trace_enabled = 1;
+	trace_process_name(getpid(), "shell");
+}
+
+/**
+ * Write out everything that's buffered and finish the trace file
+ */
+void trace_close() {
+	if (!trace_enabled) {
+		return;
+	}
+	trace_enabled = 0;
+	append("\n]\n", 3);
+	swap_buffers();
+
+	pthread_mutex_lock(&lock);
+	stopping = 1;
+	pthread_cond_signal(&work);
+	pthread_mutex_unlock(&lock);
+	pthread_join(writer, NULL);
+
+	close(trace_fd);
+	trace_fd = -1;
+}
+
+/**
+ * Start or stop tracing to match $SHELL_TRACE
+ */
+void trace_changed() {
+	trace_close();
+	const char* path = var_get("SHELL_TRACE");
+	if (path && *path) {
+		trace_open(path);
+	}
+}
+
+/**
+ * Copy a string into JSON, escaping as needed
+ * @return New write position
+ */
+static char* json_string(char* w, const char* end, const char* s) {
+	for (; *s && w < end - 2; s++) {
+		if (*s == '"' || *s == '\\') {
+			*w++ = '\\';
+			*w++ = *s;
+		} else if ((unsigned char)*s >= ' ') {
+			*w++ = *s;
+		}
+	}
+	return w;
+}
+
+/**
+ * Record something that took a while
+ * @param name What it was
+ * @param cat Category, for filtering in the viewer
+ * @param start When it started, in seconds on the monotonic clock
+ * @param end When it ended
+ * @param pid Row group, the shell or a pipeline's process group
+ * @param tid Row within the group
+ * @param args printf format for the body of the event's args object, or NULL
+ */
+void trace_span(const char* name, const char* cat, double start, double end, pid_t pid, pid_t tid,
+		const char* args, ...) {
+	if (!trace_enabled) {
+		return;
+	}
+
+	char event[TRACE_EVENT_MAX];
+	const char* event_end = event + sizeof(event) - 64; // Room for the closing part
+	char* w = event;
+	w += sprintf(w, "%s{\"ph\": \"X\", \"name\": \"", events++ ? ",\n" : "");
+	w = json_string(w, event_end, name);
+	w += sprintf(w, "\", \"cat\": \"%s\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": %d, \"tid\": %d",
+		cat, start * 1e6, (end - start) * 1e6, (int)pid, (int)tid);
+	if (args) {
+		w = stpcpy(w, ", \"args\": {");
+		va_list ap;
+		va_start(ap, args);
+		int n = vsnprintf(w, event_end - w, args, ap);
+		va_end(ap);
+		w += n < event_end - w ? n : event_end - w - 1;
+		*w++ = '}';
+	}
+	w = stpcpy(w, "}");
+	append(event, w - event);
+}
+
+/**
+ * Label a row group, e.g. with the command line of the pipeline it is
+ */
+void trace_process_name(pid_t pid, const char* name) {
+	if (!trace_enabled) {
+		return;
+	}
+
+	char event[TRACE_EVENT_MAX];
+	char* w = event;
+	w += sprintf(w, "%s{\"ph\": \"M\", \"name\": \"process_name\", \"pid\": %d, \"args\": {\"name\": \"",
+		events++ ? ",\n" : "", (int)pid);
+	w = json_string(w, event + sizeof(event) - 8, name);
+	w = stpcpy(w, "\"}}");
+	append(event, w - event);
+}
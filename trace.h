@@ -0,0 +1,18 @@
+/**
+ * @file trace.h
+ */
+
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include <sys/types.h>
+
+extern int trace_enabled; // Check before doing any work just for a trace event
+
+void trace_changed();
+void trace_close();
+void trace_span(const char* name, const char* cat, double start, double end, pid_t pid, pid_t tid,
+	const char* args, ...) __attribute__((format(printf, 7, 8)));
+void trace_process_name(pid_t pid, const char* name);
+
+#endif // _TRACE_H
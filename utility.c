@@ -1,9 +1,11 @@
 #include "utility.h"
+#include "vars.h"
 #include <string.h>
 #include <stdlib.h>
 #include <limits.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <sys/stat.h>
 
 char* trimSpaces(char* str) {
 	while (*str == ' ') { str++; } // Trim leading spaces
@@ -17,26 +19,8 @@ char* trimSpaces(char* str) {
 	return str;
 }
 
-char* replaceHome(char* path) {
-	char* fullPath = path;
-	char* home = getenv("HOME");
-	if (home == NULL) {
-		return path;
-	}
-	int i = 0;
-	while (home[i] != '\0' && home[i] == path[i]) {
-		i++;
-	}
-	if (home[i] == '\0') {
-		i--;
-		fullPath[i] = '~';
-		return fullPath + i;
-	}
-	return fullPath;
-}
-
 char* getPwd() {
-	size_t s = sizeof(char*) * PATH_MAX;
+	size_t s = sizeof(char) * PATH_MAX;
 	char* buf = (char*)malloc(s);
 	while (getcwd(buf, s) == NULL) {
 		free(buf);
@@ -46,12 +30,110 @@ char* getPwd() {
 	return buf;
 }
 
-char* buildPrompt() {
-	char* tmp = getPwd();
-	char* path = replaceHome(tmp);
-	char* prompt = (char*)malloc(strlen(path) + 4);
-	strcpy(prompt, path);
-	strcat(prompt, " $ ");
-	free(tmp);
-	return prompt;
+// Logical working directory, i.e. the path the user took to get here
+// rather than where the symlinks point
+static char* current_dir = NULL;
+
+/**
+ * Join a path onto a directory and remove any ".", ".." and repeated slashes,
+ * without looking at the filesystem
+ * @param dir Absolute directory relative paths start from
+ * @param path Absolute or relative path
+ * @return Newly allocated absolute path
+ */
+static char* normalizePath(const char* dir, const char* path) {
+	size_t dir_len = path[0] == '/' ? 0 : strlen(dir);
+	char* joined = (char*)malloc(dir_len + strlen(path) + 3);
+	if (dir_len) {
+		strcpy(joined, dir);
+		strcat(joined, "/");
+		strcat(joined, path);
+	} else {
+		strcpy(joined, path);
+	}
+
+	// Copy components down over the top of the string, backing up for ".."
+	char* out = joined;
+	char* in = joined;
+	while (*in) {
+		while (*in == '/') { in++; }
+		char* end = in;
+		while (*end && *end != '/') { end++; }
+		size_t len = end - in;
+		if (len == 0 || (len == 1 && in[0] == '.')) {
+			// Nothing to add
+		} else if (len == 2 && in[0] == '.' && in[1] == '.') {
+			while (out > joined && *(--out) != '/') {}
+		} else {
+			*out++ = '/';
+			memmove(out, in, len);
+			out += len;
+		}
+		in = end;
+	}
+	if (out == joined) {
+		*out++ = '/';
+	}
+	*out = '\0';
+	return joined;
+}
+
+/**
+ * Get the logical working directory without a syscall
+ * @return The current directory, valid until the next changeDir()
+ */
+const char* currentDir() {
+	if (current_dir == NULL) {
+		// Trust $PWD if it's really where we are, so we keep whatever
+		// symlinks the user came through
+		const char* pwd = var_get("PWD");
+		struct stat pwd_st, dot_st;
+		if (pwd && pwd[0] == '/' && stat(pwd, &pwd_st) == 0 && stat(".", &dot_st) == 0 &&
+				pwd_st.st_dev == dot_st.st_dev && pwd_st.st_ino == dot_st.st_ino) {
+			current_dir = normalizePath("/", pwd);
+		} else {
+			current_dir = getPwd();
+		}
+	}
+	return current_dir;
+}
+
+/**
+ * Change directory, keeping track of the logical path. ".." goes back up
+ * the path we came down, like cd in other shells, unless that doesn't
+ * exist in which case we fall back to what the kernel thinks.
+ * @param path Directory to change to
+ * @return 0 on success, -1 with errno set on failure
+ */
+int changeDir(const char* path) {
+	char* logical = normalizePath(currentDir(), path);
+	if (chdir(logical) < 0) {
+		free(logical);
+		if (chdir(path) < 0) {
+			return -1;
+		}
+		logical = getPwd();
+	}
+	free(current_dir);
+	current_dir = logical;
+	return 0;
+}
+
+/**
+ * Arguments for running a script with no shebang through /bin/sh, the way
+ * execvp does when exec gives ENOEXEC
+ * @param path Script that couldn't be executed
+ * @param argv Its arguments, NULL terminated
+ * @return Newly allocated argv for /bin/sh, sharing the strings in argv
+ */
+char** sh_fallback_argv(const char* path, char* const argv[]) {
+	size_t argc = 0;
+	while (argv[argc]) {
+		argc++;
+	}
+	char** sh_argv = (char**)malloc(sizeof(char*) * (argc + 2));
+	sh_argv[0] = "sh";
+	sh_argv[1] = (char*)path;
+	memcpy(sh_argv + 2, argv + 1, sizeof(char*) * argc); // Brings the NULL along
+	return sh_argv;
 }
@@ -13,8 +13,9 @@ typedef enum {
 } status_t;
 
 char* trimSpaces(char* str);
-char* replaceHome(char* path);
 char* getPwd();
-char* buildPrompt();
+const char* currentDir();
+int changeDir(const char* path);
+char** sh_fallback_argv(const char* path, char* const argv[]);
 
 #endif // _UTILITY_H
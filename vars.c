@@ -0,0 +1,282 @@
+/**
+ * @file vars.c
+ *
+ * Shell variables. They live in an open addressing hash table instead of
+ * environ, so looking one up or setting it doesn't scan every variable, and
+ * setting one doesn't leak the old value like setenv does.
+ *
+ * Each variable is stored as a "name=value" string, so the environment
+ * handed to exec is just an array of pointers to the exported ones. It's
+ * only rebuilt when an exported variable has changed since the last exec,
+ * so setting local variables never costs anything at launch.
+ */
+
+#include "vars.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#define VARS_MIN_SLOTS 64
+
+extern char** environ;
+
+struct var_t {
+	char* entry;           // "name=value", NULL if the slot is free
+	unsigned int hash;
+	unsigned int name_len;
+	char exported;
+	char deleted;          // Free, but something probed past it once
+};
+
+static struct var_t* slots = NULL;
+static size_t slot_count = 0; // Always a power of two
+static size_t used = 0;       // Live variables plus deleted slots
+static size_t live = 0;
+static size_t exported_count = 0;
+
+static char** env = NULL; // Cached environment for exec
+static size_t env_size = 0;
+static int env_dirty = 1;
+
+static unsigned int hash_name(const char* name, size_t len) {
+	unsigned int h = 5381;
+	for (size_t i = 0; i < len; i++) {
+		h = h * 33 + (unsigned char)name[i];
+	}
+	return h;
+}
+
+/**
+ * Find a variable's slot, or the slot it should go in
+ * @param found Set to whether the variable exists
+ */
+static struct var_t* find_slot(const char* name, size_t len, unsigned int hash, int* found) {
+	struct var_t* free_slot = NULL;
+	size_t mask = slot_count - 1;
+	for (size_t i = hash & mask;; i = (i + 1) & mask) {
+		struct var_t* var = &slots[i];
+		if (var->entry == NULL) {
+			if (!var->deleted) {
+				*found = 0;
+				return free_slot ? free_slot : var;
+			}
+			if (free_slot == NULL) {
+				free_slot = var;
+			}
+		} else if (var->hash == hash && var->name_len == len && memcmp(var->entry, name, len) == 0) {
+			*found = 1;
+			return var;
+		}
+	}
+}
+
+/**
+ * Make room for another variable, dropping deleted slots while we're at it
+ */
+static void grow() {
+	size_t new_count = slot_count ? slot_count : VARS_MIN_SLOTS;
+	while ((live + 1) * 2 > new_count) {
+		new_count *= 2;
+	}
+
+	struct var_t* old = slots;
+	size_t old_count = slot_count;
+	slots = (struct var_t*)calloc(new_count, sizeof(struct var_t));
+	slot_count = new_count;
+	used = live;
+	for (size_t i = 0; i < old_count; i++) {
+		if (old[i].entry) {
+			int found;
+			*find_slot(old[i].entry, old[i].name_len, old[i].hash, &found) = old[i];
+		}
+	}
+	free(old);
+}
+
+static void insert(char* entry, size_t name_len, int exported) {
+	if ((used + 1) * 4 > slot_count * 3) {
+		grow();
+	}
+	unsigned int hash = hash_name(entry, name_len);
+	int found;
+	struct var_t* var = find_slot(entry, name_len, hash, &found);
+	if (found) {
+		exported = exported || var->exported;
+		if (var->exported) {
+			exported_count--;
+		}
+		free(var->entry);
+	} else {
+		if (!var->deleted) {
+			used++;
+		}
+		live++;
+	}
+	var->entry = entry;
+	var->hash = hash;
+	var->name_len = name_len;
+	var->exported = exported;
+	var->deleted = 0;
+	if (exported) {
+		exported_count++;
+		env_dirty = 1;
+	}
+}
+
+/**
+ * Take in the environment we were started with, all of it exported
+ */
+static void init() {
+	grow();
+	for (char** e = environ; *e; e++) {
+		const char* eq = strchr(*e, '=');
+		if (eq && eq != *e) {
+			insert(strdup(*e), eq - *e, 1);
+		}
+	}
+}
+
+static struct var_t* lookup(const char* name, size_t len) {
+	if (slots == NULL) {
+		init();
+	}
+	int found;
+	struct var_t* var = find_slot(name, len, hash_name(name, len), &found);
+	return found ? var : NULL;
+}
+
+/**
+ * @return The variable's value, or NULL if it's unset. Valid until the
+ *         variable is next set or deleted.
+ */
+const char* var_get(const char* name) {
+	return var_getn(name, strlen(name));
+}
+
+/**
+ * @return Whether a variable used as an option is turned on: set to
+ *         anything but nothing or 0
+ */
+int var_enabled(const char* name) {
+	const char* value = var_get(name);
+	return value && *value && strcmp(value, "0") != 0;
+}
+
+/**
+ * Same as var_get, for a name that isn't NUL terminated
+ * @param len Length of the name
+ */
+const char* var_getn(const char* name, size_t len) {
+	struct var_t* var = lookup(name, len);
+	return var ? var->entry + var->name_len + 1 : NULL;
+}
+
+/**
+ * Set a variable
+ * @param name Name, which can't be empty or contain an =
+ * @param value New value
+ * @param export Export it to commands we run. Otherwise a new variable is
+ *               local and an existing one keeps whatever it was.
+ * @return 0 on success, -1 with errno set if the name isn't valid
+ */
+int var_set(const char* name, const char* value, int export) {
+	if (*name == '\0' || strchr(name, '=') != NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (slots == NULL) {
+		init();
+	}
+	size_t name_len = strlen(name);
+	size_t value_len = strlen(value);
+	char* entry = (char*)malloc(name_len + value_len + 2);
+	memcpy(entry, name, name_len);
+	entry[name_len] = '=';
+	memcpy(entry + name_len + 1, value, value_len + 1);
+	insert(entry, name_len, export);
+	return 0;
+}
+
+/**
+ * Export an existing variable to commands we run
+ * @return 0 on success, -1 if it's unset
+ */
+int var_export(const char* name) {
+	struct var_t* var = lookup(name, strlen(name));
+	if (var == NULL) {
+		return -1;
+	}
+	if (!var->exported) {
+		var->exported = 1;
+		exported_count++;
+		env_dirty = 1;
+	}
+	return 0;
+}
+
+/**
+ * @return 0 if the variable was deleted, -1 if it was already unset
+ */
+int var_delete(const char* name) {
+	struct var_t* var = lookup(name, strlen(name));
+	if (var == NULL) {
+		return -1;
+	}
+	if (var->exported) {
+		exported_count--;
+		env_dirty = 1;
+	}
+	free(var->entry);
+	var->entry = NULL;
+	var->deleted = 1;
+	live--;
+	return 0;
+}
+
+/**
+ * Get the environment for a command we're about to run
+ * @return NULL terminated array of the exported variables, valid until one
+ *         of them is next changed
+ */
+char** vars_environ() {
+	if (slots == NULL) {
+		init();
+	}
+	if (!env_dirty) {
+		return env;
+	}
+	if (exported_count + 1 > env_size) {
+		free(env);
+		env_size = (exported_count + 1) * 2;
+		env = (char**)malloc(sizeof(char*) * env_size);
+	}
+	size_t n = 0;
+	for (size_t i = 0; i < slot_count; i++) {
+		if (slots[i].entry && slots[i].exported) {
+			env[n++] = slots[i].entry;
+		}
+	}
+	env[n] = NULL;
+	env_dirty = 0;
+	return env;
+}
+
+static int compare_entries(const void* a, const void* b) {
+	return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+/**
+ * Print the exported variables, sorted by name
+ */
+void vars_print_exported() {
+	char** e = vars_environ();
+	char** sorted = (char**)malloc(sizeof(char*) * (exported_count + 1));
+	memcpy(sorted, e, sizeof(char*) * (exported_count + 1));
+	qsort(sorted, exported_count, sizeof(char*), compare_entries);
+	for (size_t i = 0; i < exported_count; i++) {
+		const char* eq = strchr(sorted[i], '=');
+		printf("%.*s = %s\n", (int)(eq - sorted[i]), sorted[i], eq + 1);
+	}
+	free(sorted);
+}
@@ -0,0 +1,19 @@
+/**
+ * @file vars.h
+ */
+
+#ifndef _VARS_H
+#define _VARS_H
+
+#include <stddef.h>
+
+const char* var_get(const char* name);
+const char* var_getn(const char* name, size_t len);
+int var_enabled(const char* name);
+int var_set(const char* name, const char* value, int export);
+int var_export(const char* name);
+int var_delete(const char* name);
+char** vars_environ();
+void vars_print_exported();
+
+#endif // _VARS_H
@@ -0,0 +1,438 @@
+/**
+ * @file zygote.c
+ *
+ * An optional helper that launches externals for the shell. It's forked at
+ * startup while the shell is still small, and only ever runs this file's
+ * code, so forking it stays cheap however big the shell gets and the child
+ * has next to nothing to set up before it execs.
+ *
+ * The shell sends each launch as one message on a request socket: the
+ * process group, path, directory, argv and environment, with the child's
+ * stdin and stdout attached as SCM_RIGHTS. The reply is the pid once the
+ * child has exec'd, or why it couldn't. The zygote reaps its children and
+ * sends each state change on a second socket, then pokes the shell with
+ * SIGCHLD so it looks, so they end up in the job table like any other
+ * child's.
+ *
+ * A process group only lasts as long as a member does, so a pipeline's
+ * first stage mustn't be reaped before the rest have joined it. When the
+ * shell blocks SIGCHLD the zombie takes care of that, but the zygote reaps
+ * on its own, so launching a group leader puts it on hold until the shell
+ * sends a release.
+ */
+
+#define _GNU_SOURCE // pipe2, MSG_CMSG_CLOEXEC
+#include "zygote.h"
+#include "utility.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <sys/signalfd.h>
+
+#define ZYGOTE_MAX_REQUEST (1 << 17)
+
+struct request_t {
+	int release; // Start reaping again, nothing else follows
+	pid_t pgid;
+	uint32_t argc;
+	uint32_t envc;
+	// Followed by path, directory, argv and environment, NUL terminated
+};
+
+struct reply_t {
+	pid_t pid;
+	int err; // errno if pid is -1
+};
+
+static int request_sock = -1; // Launches out, replies back
+static int status_sock = -1;  // State changes of the zygote's children
+static char* request_buf = NULL;
+static int holding = 0; // A group leader was launched and not released yet
+
+// Only used in the zygote
+static struct zygote_status_t* queue = NULL; // Statuses the shell hasn't had room for yet
+static size_t queued = 0;
+static size_t queue_size = 0;
+
+/**
+ * Send queued statuses until the shell's socket is full
+ */
+static void flush_statuses(int out) {
+	size_t sent = 0;
+	while (sent < queued) {
+		if (send(out, &queue[sent], sizeof(struct zygote_status_t), MSG_DONTWAIT | MSG_NOSIGNAL) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			break;
+		}
+		sent++;
+	}
+	memmove(queue, queue + sent, sizeof(struct zygote_status_t) * (queued - sent));
+	queued -= sent;
+	if (sent > 0) {
+		kill(getppid(), SIGCHLD);
+	}
+}
+
+static void reap(int out) {
+	struct zygote_status_t status;
+	while ((status.pid = wait4(-1, &status.status, WNOHANG | WUNTRACED | WCONTINUED, &status.usage)) > 0) {
+		clock_gettime(CLOCK_MONOTONIC, &status.when);
+		if (queued == queue_size) {
+			queue_size = queue_size ? queue_size * 2 : 64;
+			queue = (struct zygote_status_t*)realloc(queue, sizeof(struct zygote_status_t) * queue_size);
+		}
+		queue[queued++] = status;
+	}
+	flush_statuses(out);
+}
+
+/**
+ * In the forked child, become the command
+ */
+static void become(const char* path, char** argv, char** envp, const char* cwd, int in_fd, int out_fd,
+		pid_t pgid, const sigset_t* child_mask, int err_fd) {
+	signal(SIGINT, SIG_DFL);
+	signal(SIGQUIT, SIG_DFL);
+	signal(SIGTSTP, SIG_DFL);
+	signal(SIGTTIN, SIG_DFL);
+	signal(SIGTTOU, SIG_DFL);
+	signal(SIGCHLD, SIG_DFL);
+	sigprocmask(SIG_SETMASK, child_mask, NULL);
+
+	if (setpgid(0, pgid) == 0 && chdir(cwd) == 0 &&
+			(in_fd == STDIN_FILENO || dup2(in_fd, STDIN_FILENO) >= 0) &&
+			(out_fd == STDOUT_FILENO || dup2(out_fd, STDOUT_FILENO) >= 0)) {
+		execve(path, argv, envp);
+		if (errno == ENOEXEC) {
+			execve("/bin/sh", sh_fallback_argv(path, argv), envp);
+		}
+	}
+	int err = errno;
+	write(err_fd, &err, sizeof(err));
+	_exit(127);
+}
+
+/**
+ * Handle one launch request
+ * @return 0 once the shell has gone away
+ */
+static int serve(int req, char* buf, const sigset_t* child_mask) {
+	union {
+		char buf[CMSG_SPACE(sizeof(int) * 2)];
+		struct cmsghdr align;
+	} control;
+	struct iovec iov = {buf, ZYGOTE_MAX_REQUEST};
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+
+	ssize_t len = recvmsg(req, &msg, MSG_CMSG_CLOEXEC);
+	if (len <= 0) {
+		return len < 0 && errno == EINTR;
+	}
+	struct request_t* request = (struct request_t*)buf;
+	if ((size_t)len >= sizeof(struct request_t) && request->release) {
+		holding = 0;
+		return 1;
+	}
+	struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+	if (cmsg == NULL || cmsg->cmsg_type != SCM_RIGHTS || (size_t)len < sizeof(struct request_t)) {
+		return 1; // Not from the shell
+	}
+	int fds[2];
+	memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+	char* s = buf + sizeof(struct request_t);
+	const char* path = s;
+	s += strlen(s) + 1;
+	const char* cwd = s;
+	s += strlen(s) + 1;
+	char** argv = (char**)malloc(sizeof(char*) * (request->argc + 1));
+	char** envp = (char**)malloc(sizeof(char*) * (request->envc + 1));
+	for (uint32_t i = 0; i < request->argc; i++, s += strlen(s) + 1) {
+		argv[i] = s;
+	}
+	argv[request->argc] = NULL;
+	for (uint32_t i = 0; i < request->envc; i++, s += strlen(s) + 1) {
+		envp[i] = s;
+	}
+	envp[request->envc] = NULL;
+
+	// The child reports a failed exec here, a successful one just closes it
+	struct reply_t reply = {-1, 0};
+	int err_pipe[2];
+	if (pipe2(err_pipe, O_CLOEXEC) < 0) {
+		reply.err = errno;
+	} else {
+		pid_t pid = fork();
+		if (pid == 0) {
+			close(err_pipe[0]);
+			become(path, argv, envp, cwd, fds[0], fds[1], request->pgid, child_mask, err_pipe[1]);
+		}
+		close(err_pipe[1]);
+		if (pid < 0) {
+			reply.err = errno;
+		} else {
+			ssize_t n;
+			while ((n = read(err_pipe[0], &reply.err, sizeof(reply.err))) < 0 && errno == EINTR) {}
+			if (n != sizeof(reply.err)) {
+				reply.pid = pid;
+				reply.err = 0;
+				if (request->pgid == 0) {
+					holding = 1;
+				}
+			}
+		}
+		close(err_pipe[0]);
+	}
+	close(fds[0]);
+	close(fds[1]);
+	free(argv);
+	free(envp);
+
+	return send(req, &reply, sizeof(reply), MSG_NOSIGNAL) == sizeof(reply);
+}
+
+static void zygote_main(int req, int out, const sigset_t* child_mask) {
+	// Keep out of the terminal's way, ^C is for whatever's in the foreground
+	setpgid(0, 0);
+	signal(SIGINT, SIG_IGN);
+	signal(SIGQUIT, SIG_IGN);
+
+	sigset_t chld;
+	sigemptyset(&chld);
+	sigaddset(&chld, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &chld, NULL);
+	signal(SIGCHLD, SIG_DFL);
+	int sig_fd = signalfd(-1, &chld, SFD_CLOEXEC);
+	if (sig_fd < 0) {
+		perror("zygote: Failed to watch for children");
+		_exit(1);
+	}
+
+	char* buf = (char*)malloc(ZYGOTE_MAX_REQUEST);
+	while (1) {
+		struct pollfd fds[3] = {
+			{req, POLLIN, 0},
+			{sig_fd, holding ? 0 : POLLIN, 0},
+			{out, queued ? POLLOUT : 0, 0},
+		};
+		if (poll(fds, 3, -1) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			break;
+		}
+		if (fds[1].revents & POLLIN) {
+			struct signalfd_siginfo info;
+			while (read(sig_fd, &info, sizeof(info)) < 0 && errno == EINTR) {}
+			reap(out);
+		}
+		if (fds[2].revents & POLLOUT) {
+			flush_statuses(out);
+		}
+		if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+			if (!serve(req, buf, child_mask)) {
+				break;
+			}
+		}
+	}
+	_exit(0);
+}
+
+static void forked_child() {
+	// Replies would be read by whichever process got there first
+	if (request_sock >= 0) {
+		close(request_sock);
+		close(status_sock);
+		request_sock = status_sock = -1;
+	}
+}
+
+/**
+ * Fork the zygote. Do it early, while there's not much of us to copy.
+ * @return 0 on success, -1 if launches will have to be done directly
+ */
+int zygote_start() {
+	int req[2], status[2];
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, req) < 0) {
+		perror("zygote: Failed to create socket");
+		return -1;
+	}
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, status) < 0) {
+		perror("zygote: Failed to create socket");
+		close(req[0]);
+		close(req[1]);
+		return -1;
+	}
+
+	// Children start out with the mask we have now
+	sigset_t child_mask;
+	sigprocmask(SIG_SETMASK, NULL, &child_mask);
+
+	fflush(stdout);
+	fflush(stderr);
+	pid_t pid = fork();
+	if (pid < 0) {
+		perror("zygote: Failed to fork");
+		close(req[0]);
+		close(req[1]);
+		close(status[0]);
+		close(status[1]);
+		return -1;
+	} else if (pid == 0) {
+		close(req[0]);
+		close(status[0]);
+		zygote_main(req[1], status[1], &child_mask);
+	}
+
+	close(req[1]);
+	close(status[1]);
+	request_sock = req[0];
+	status_sock = status[0];
+	request_buf = (char*)malloc(ZYGOTE_MAX_REQUEST);
+	pthread_atfork(NULL, NULL, forked_child);
+	return 0;
+}
+
+int zygote_active() {
+	return request_sock >= 0;
+}
+
+static char* pack(char* w, const char* end, const char* s) {
+	size_t len = strlen(s) + 1;
+	if (w == NULL || w + len > end) {
+		return NULL;
+	}
+	memcpy(w, s, len);
+	return w + len;
+}
+
+/**
+ * Have the zygote launch a command
+ * @param path Executable
+ * @param argv Arguments
+ * @param envp Environment
+ * @param cwd Directory to run in
+ * @param in_fd Becomes the child's stdin
+ * @param out_fd Becomes the child's stdout
+ * @param pgid Process group to join, or 0 to start a new one
+ * @return The child's pid, or -1 with errno set. EAGAIN means the zygote
+ *         couldn't take it and the caller should launch it itself.
+ */
+pid_t zygote_spawn(const char* path, char* const argv[], char* const envp[], const char* cwd,
+		int in_fd, int out_fd, pid_t pgid) {
+	if (request_sock < 0) {
+		errno = EAGAIN;
+		return -1;
+	}
+
+	struct request_t* request = (struct request_t*)request_buf;
+	const char* end = request_buf + ZYGOTE_MAX_REQUEST;
+	char* w = request_buf + sizeof(struct request_t);
+	request->release = 0;
+	request->pgid = pgid;
+	request->argc = request->envc = 0;
+	w = pack(w, end, path);
+	w = pack(w, end, cwd);
+	for (; argv[request->argc]; request->argc++) {
+		w = pack(w, end, argv[request->argc]);
+	}
+	for (; envp[request->envc]; request->envc++) {
+		w = pack(w, end, envp[request->envc]);
+	}
+	if (w == NULL) {
+		errno = EAGAIN;
+		return -1;
+	}
+
+	union {
+		char buf[CMSG_SPACE(sizeof(int) * 2)];
+		struct cmsghdr align;
+	} control;
+	struct iovec iov = {request_buf, w - request_buf};
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+	struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int) * 2);
+	int fds[2] = {in_fd, out_fd};
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+	ssize_t n;
+	while ((n = sendmsg(request_sock, &msg, MSG_NOSIGNAL)) < 0 && errno == EINTR) {}
+	if (n < 0) {
+		if (errno == EMSGSIZE) {
+			errno = EAGAIN;
+			return -1;
+		}
+		perror("zygote: Failed to send launch, launching directly from now on");
+		forked_child();
+		errno = EAGAIN;
+		return -1;
+	}
+
+	struct reply_t reply;
+	while ((n = recv(request_sock, &reply, sizeof(reply), 0)) < 0 && errno == EINTR) {}
+	if (n != sizeof(reply)) {
+		fprintf(stderr, "zygote: Went away, launching directly from now on\n");
+		forked_child();
+		errno = EAGAIN;
+		return -1;
+	}
+	if (reply.pid < 0) {
+		errno = reply.err;
+	} else if (pgid == 0) {
+		holding = 1;
+	}
+	return reply.pid;
+}
+
+/**
+ * Let the zygote reap again once a pipeline's stages have all joined its
+ * process group
+ */
+void zygote_release() {
+	if (!holding || request_sock < 0) {
+		return;
+	}
+	holding = 0;
+	struct request_t request;
+	memset(&request, 0, sizeof(request));
+	request.release = 1;
+	while (send(request_sock, &request, sizeof(request), MSG_NOSIGNAL) < 0 && errno == EINTR) {}
+}
+
+/**
+ * Get the next state change of one of the zygote's children
+ * @param status Filled in with it
+ * @param block Wait for one if there isn't one yet
+ * @return 1 if there was one, else 0
+ */
+int zygote_next_status(struct zygote_status_t* status, int block) {
+	if (status_sock < 0) {
+		return 0;
+	}
+	ssize_t n;
+	while ((n = recv(status_sock, status, sizeof(*status), block ? 0 : MSG_DONTWAIT)) < 0 && errno == EINTR) {}
+	return n == sizeof(*status);
+}
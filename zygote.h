@@ -0,0 +1,27 @@
+/**
+ * @file zygote.h
+ */
+
+#ifndef _ZYGOTE_H
+#define _ZYGOTE_H
+
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <time.h>
+
+// A child of the zygote changed state
+struct zygote_status_t {
+	pid_t pid;
+	int status;           // As from waitpid
+	struct timespec when; // When it was reaped, on the monotonic clock
+	struct rusage usage;
+};
+
+int zygote_start();
+int zygote_active();
+pid_t zygote_spawn(const char* path, char* const argv[], char* const envp[], const char* cwd,
+	int in_fd, int out_fd, pid_t pgid);
+void zygote_release();
+int zygote_next_status(struct zygote_status_t* status, int block);
+
+#endif // _ZYGOTE_H